@@ -0,0 +1,128 @@
+ /* ----- <push/asio/atomic_file_writer.hpp> ------------------------------- */
+#ifndef push_asio_atomic_file_writer_hpp_INCLUDED
+#define push_asio_atomic_file_writer_hpp_INCLUDED
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <push/asio/background_service.hpp>
+#include <push/asio/atomic_file_writer_ops.hpp>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* async_publish() replaces a file atomically and durably: readers see
+  * either the old or the new content, and once the handler is called the
+  * new content survives a crash.
+  * 
+  * That needs the data synced before the rename and the directory synced
+  * after it.  The first part is done in one background job per file; the
+  * directory fsyncs of all files published into the same directory within
+  * sync_window are coalesced into a single one, which completes all of
+  * them.
+  * 
+  * The atomic_file_writer must outlive all of its operations.
+  */
+
+namespace push {
+namespace asio {
+
+class atomic_file_writer {
+public:
+	explicit atomic_file_writer(
+		boost::asio::io_service &io_service,
+		std::chrono::microseconds sync_window = std::chrono::milliseconds(2)) :
+		io_service(io_service),
+		sync_window(sync_window)
+	{
+	}
+	 /* handler: void (boost::system::error_code) */
+	template <typename ConstBufferSequence, typename PublishHandler>
+	void async_publish(
+		const boost::filesystem::path &path,
+		const ConstBufferSequence &buffers,
+		mode_t mode,
+		PublishHandler handler)
+	{
+		typedef detail::atomic_file_writer::publish_op<ConstBufferSequence> Op;
+		auto dir = detail::atomic_file_writer::directory_of(path);
+		background().do_in_background(
+		    Op(path, buffers, mode),
+		    [this, dir, handler](boost::system::error_code ec)
+		    {
+			    if (ec)
+				    handler(ec);
+			    else
+				    sync_directory(dir, handler);
+		    });
+	}
+	template <typename ConstBufferSequence, typename PublishHandler>
+	void async_publish(
+		const boost::filesystem::path &path,
+		const ConstBufferSequence &buffers,
+		PublishHandler handler)
+	{
+		async_publish(path, buffers, 0644, handler);
+	}
+
+private:
+	typedef std::function<void (boost::system::error_code)> waiter;
+
+	struct batch {
+		explicit batch(boost::asio::io_service &io_service) : timer(io_service) { }
+		boost::asio::steady_timer timer;
+		std::vector<waiter> waiters;
+	};
+
+	void sync_directory(
+		const boost::filesystem::path &dir,
+		waiter handler)
+	{
+		std::shared_ptr<batch> b;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto &pending = batches[dir];
+			if (pending) {
+				pending->waiters.push_back(handler);
+				return;
+			}
+			b = pending = std::make_shared<batch>(io_service);
+			b->waiters.push_back(handler);
+		}
+		b->timer.expires_from_now(sync_window);
+		b->timer.async_wait(
+			[this, dir, b](boost::system::error_code)
+			{
+				 /* files renamed from now on need another fsync */
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					batches.erase(dir);
+				}
+				background().do_in_background(
+				    detail::atomic_file_writer::sync_directory_op(dir),
+				    [b](boost::system::error_code ec)
+				    {
+					    for (auto &w : b->waiters)
+						    w(ec);
+				    });
+			});
+	}
+	background_service &background()
+	{
+		return boost::asio::use_service<background_service>(io_service);
+	}
+
+	boost::asio::io_service &io_service;
+	std::chrono::microseconds sync_window;
+	std::mutex mutex;
+	std::map<boost::filesystem::path, std::shared_ptr<batch>> batches;
+};
+
+}
+}
+
+#endif
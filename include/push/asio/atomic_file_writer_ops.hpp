@@ -0,0 +1,180 @@
+ /* ----- <push/asio/atomic_file_writer_ops.hpp> --------------------------- */
+#ifndef push_asio_atomic_file_writer_ops_hpp_INCLUDED
+#define push_asio_atomic_file_writer_ops_hpp_INCLUDED
+
+#include <atomic>
+#include <string>
+#include <tuple>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <push/asio/trace.hpp>
+
+namespace push {
+namespace asio {
+namespace detail {
+namespace atomic_file_writer {
+
+inline boost::system::error_code last_error()
+{
+	return boost::system::error_code(errno, boost::system::system_category());
+}
+
+inline boost::filesystem::path directory_of(const boost::filesystem::path &path)
+{
+	auto dir = path.parent_path();
+	return dir.empty() ? boost::filesystem::path(".") : dir;
+}
+
+inline boost::filesystem::path temp_name(const boost::filesystem::path &path)
+{
+	static std::atomic<unsigned long> counter(0);
+	return path.native() +
+		".tmp." + std::to_string(::getpid()) +
+		"." + std::to_string(++counter);
+}
+
+ /* writes the data to an unnamed (O_TMPFILE) or temporary file in the
+  * target's directory, syncs it and renames it over the target.  The
+  * directory itself is not synced, see sync_directory_op.
+  */
+template <typename ConstBufferSequence>
+struct publish_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	publish_op(
+		const boost::filesystem::path &path,
+		ConstBufferSequence buffer,
+		mode_t mode) :
+		path(path),
+		buffer(buffer),
+		mode(mode)
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		auto temp = temp_name(path);
+#ifdef O_TMPFILE
+		if (publish_unnamed(temp, ec))
+			return;
+#endif
+		publish_named(temp, ec);
+	}
+	 /* an O_TMPFILE only gets a name by linking /proc/self/fd/N, which
+	  * needs /proc and may be refused (e.g. by a security module).  Returns
+	  * false if the file could not be created or linked, so the caller
+	  * writes the data again to a named temporary file; true if it was
+	  * published or failed for good (ec).
+	  */
+	bool publish_unnamed(
+		const boost::filesystem::path &temp,
+		boost::system::error_code &ec)
+	{
+		int fh = ::open(directory_of(path).native().c_str(), O_TMPFILE | O_WRONLY, mode);
+		if (fh == -1)
+			return false;
+		write(fh, ec);
+		if (!ec && ::fdatasync(fh) != 0)
+			ec = last_error();
+		bool linked = false;
+		if (!ec) {
+			std::string proc = "/proc/self/fd/" + std::to_string(fh);
+			linked = ::linkat(AT_FDCWD, proc.c_str(), AT_FDCWD, temp.native().c_str(), AT_SYMLINK_FOLLOW) == 0;
+		}
+		if (::close(fh) != 0 && !ec)
+			ec = last_error();
+		if (linked)
+			rename(temp, ec);
+		return linked || ec;
+	}
+	void publish_named(
+		const boost::filesystem::path &temp,
+		boost::system::error_code &ec)
+	{
+		int fh = ::open(temp.native().c_str(), O_CREAT | O_EXCL | O_WRONLY, mode);
+		if (fh == -1) {
+			ec = last_error();
+			return;
+		}
+		write(fh, ec);
+		if (!ec && ::fdatasync(fh) != 0)
+			ec = last_error();
+		if (::close(fh) != 0 && !ec)
+			ec = last_error();
+		rename(temp, ec);
+	}
+	 /* renames temp over the target, or removes it after an error */
+	void rename(
+		const boost::filesystem::path &temp,
+		boost::system::error_code &ec)
+	{
+		if (!ec && ::rename(temp.native().c_str(), path.native().c_str()) != 0)
+			ec = last_error();
+		if (ec)
+			::unlink(temp.native().c_str());
+	}
+	void write(int fh, boost::system::error_code &ec)
+	{
+		std::uint64_t offset = 0;
+		for (const auto &e : buffer) {
+			auto p = boost::asio::buffer_cast<const char *>(e);
+			std::size_t size = boost::asio::buffer_size(e);
+			while (size) {
+				auto ret = ::pwrite(fh, p, size, offset);
+				if (ret == -1) {
+					if (errno == EINTR)
+						continue;
+					ec = last_error();
+					return;
+				}
+				p += ret;
+				size -= ret;
+				offset += ret;
+			}
+		}
+	}
+	boost::filesystem::path path;
+	ConstBufferSequence buffer;
+	mode_t mode;
+};
+
+struct sync_directory_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	sync_directory_op(
+		const boost::filesystem::path &path) :
+		path(path)
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		int fh = ::open(path.native().c_str(), O_RDONLY | O_DIRECTORY);
+		if (fh == -1) {
+			ec = last_error();
+			return;
+		}
+		if (::fsync(fh) != 0)
+			ec = last_error();
+		::close(fh);
+	}
+	boost::filesystem::path path;
+};
+
+template <typename ConstBufferSequence>
+trace::op_info trace_info(const publish_op<ConstBufferSequence> &op)
+{
+	return trace::op_info{"publish", -1, 0, boost::asio::buffer_size(op.buffer)};
+}
+
+inline trace::op_info trace_info(const sync_directory_op &)
+{
+	return trace::op_info{"fsync directory", -1, 0, 0};
+}
+
+}
+}
+}
+}
+
+#endif
@@ -2,9 +2,17 @@
 #ifndef push_asio_background_service_hpp_INCLUDED
 #define push_asio_background_service_hpp_INCLUDED
 
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <push/apply_tuple.hpp>
+#include <push/asio/qos.hpp>
+#include <push/asio/trace.hpp>
 
  /* ----- idea ------------------------------------------------------------- */
  /* when writing 
@@ -16,41 +24,69 @@ namespace asio {
 namespace detail {
 namespace background_service {
 
+template <typename Parameter, typename Handler>
+struct completion {
+	Parameter parameter;
+	Handler handler;
+	std::uint64_t trace_id;
+	completion(Handler handler) : handler(handler), trace_id(0) { }
+	void operator()()
+	{
+		trace::record(trace_id, trace::event_type::handler_begin);
+		apply(handler, parameter);
+		trace::record(trace_id, trace::event_type::handler_end);
+	}
+};
+
 template <typename Operation, typename Handler>
 struct background_op {
 	template <typename O, typename H>
 	background_op(
 		boost::asio::io_service &io_service,
 		O operation,
-		H handler) :
+		H handler,
+		std::uint64_t trace_id) :
 		io_service(io_service),
 		work(io_service),
 		operation(operation),
-		handler(handler)
+		handler(handler),
+		trace_id(trace_id)
 	{ }
 	void operator()()
 	{
-		struct h_t {
-			typename Operation::parameter_type parameter;
-			Handler handler;
-			h_t(Handler handler) : handler(handler) { }
-			void operator()()
-			{
-				apply(handler, parameter);
-			}
-		} h(handler);
+		trace::record(trace_id, trace::event_type::dequeue);
+		completion<
+			typename Operation::parameter_type,
+			Handler> h(handler);
+		h.trace_id = trace_id;
+		trace::record(trace_id, trace::event_type::syscall_begin);
 		apply(operation, h.parameter);
+		trace::record(trace_id, trace::event_type::syscall_end);
 		io_service.post(h);
 	}
 	boost::asio::io_service &io_service;
 	boost::asio::io_service::work work;
 	typename std::remove_reference<Operation>::type operation;
 	Handler handler;
+	std::uint64_t trace_id;
 };
 
 }
 }
 
+ /* ops submitted through a serial_queue run one after the other, in
+  * submission order, on whatever worker is free; unrelated ops keep running
+  * in parallel.  At most one worker is busy with a queue at any time, and it
+  * goes back to the pool after each op so a long queue cannot hog it.
+  */
+class serial_queue {
+	friend class background_service;
+
+	std::mutex mutex;
+	std::deque<std::function<void ()>> ops;
+	bool running = false;
+};
+
 class background_service : public boost::asio::io_service::service {
 public:
 	static boost::asio::io_service::id id;
@@ -95,6 +131,16 @@ public:
 	void do_in_background(
 		Operation op,
 		Handler handler)
+	{
+		using trace::trace_info;
+		do_in_background(op, handler, trace::submit(trace_info(op)));
+	}
+	 /* continues tracing an op that was already submitted as trace_id */
+	template <typename Operation, typename Handler>
+	void do_in_background(
+		Operation op,
+		Handler handler,
+		std::uint64_t trace_id)
 	{
 		typedef typename detail::background_service::background_op<
 			Operation,
@@ -103,12 +149,221 @@ public:
 		    Bop(
 			get_io_service(),
 			op,
-			handler));
+			handler,
+			trace_id));
+	}
+
+	template <typename Operation, typename Handler>
+	void do_in_background(
+		const std::shared_ptr<serial_queue> &queue,
+		Operation op,
+		Handler handler)
+	{
+		typedef typename detail::background_service::background_op<
+			Operation,
+			Handler> Bop;
+		using trace::trace_info;
+		std::uint64_t trace_id = trace::submit(trace_info(op));
+		enqueue(
+		    queue,
+		    Bop(
+			get_io_service(),
+			op,
+			handler,
+			trace_id));
+	}
+
+	 /* dispatches op once group has the budget for bytes; without a group
+	  * this is the plain do_in_background.
+	  */
+	template <typename Operation, typename Handler>
+	void do_in_background(
+		const std::shared_ptr<qos_group> &group,
+		std::uint64_t bytes,
+		Operation op,
+		Handler handler)
+	{
+		typedef typename detail::background_service::background_op<
+			Operation,
+			Handler> Bop;
+		using trace::trace_info;
+		std::uint64_t trace_id = trace::submit(trace_info(op));
+		if (!group) {
+			do_in_background(op, handler, trace_id);
+			return;
+		}
+		Bop bop(
+			get_io_service(),
+			op,
+			handler,
+			trace_id);
+		pace(
+		    group,
+		    bytes,
+		    [this, bop]() { work_io_service.post(bop); });
+	}
+	 /* a serial_queue op paced by group: it only joins the queue once the
+	  * group admits it, and the group admits in submission order, so the
+	  * order of the queue is kept.
+	  */
+	template <typename Operation, typename Handler>
+	void do_in_background(
+		const std::shared_ptr<qos_group> &group,
+		std::uint64_t bytes,
+		const std::shared_ptr<serial_queue> &queue,
+		Operation op,
+		Handler handler)
+	{
+		typedef typename detail::background_service::background_op<
+			Operation,
+			Handler> Bop;
+		if (!group) {
+			do_in_background(queue, op, handler);
+			return;
+		}
+		using trace::trace_info;
+		std::uint64_t trace_id = trace::submit(trace_info(op));
+		std::function<void ()> f = Bop(
+			get_io_service(),
+			op,
+			handler,
+			trace_id);
+		pace(
+		    group,
+		    bytes,
+		    [this, queue, f]() { enqueue(queue, f); });
 	}
 
 private:
+	 /* the timer that releases the ops this service queued in a group */
+	struct qos_timer {
+		std::weak_ptr<qos_group> group;
+		boost::asio::steady_timer timer;
+		bool pending;
+		qos_timer(
+			boost::asio::io_service &io_service,
+			std::weak_ptr<qos_group> group) :
+			group(std::move(group)),
+			timer(io_service),
+			pending(false)
+		{ }
+	};
+
+	void pace(
+		const std::shared_ptr<qos_group> &group,
+		std::uint64_t bytes,
+		std::function<void ()> dispatch)
+	{
+		std::weak_ptr<qos_group> weak = group;
+		group->submit(
+		    this,
+		    bytes,
+		    dispatch,
+		    [this, weak](qos_group::clock::duration wait)
+		    {
+			arm_qos_timer(weak, wait);
+		    });
+	}
+	 /* called by the group (locked) and by the timer itself; a timer that
+	  * is armed to fire earlier is left alone.
+	  */
+	void arm_qos_timer(
+		const std::weak_ptr<qos_group> &weak,
+		qos_group::clock::duration wait)
+	{
+		auto group = weak.lock();
+		if (!group)
+			return;
+		std::lock_guard<std::mutex> lock(qos_mutex);
+		if (stopping)
+			return;
+		 /* forget the timers of groups that are gone */
+		for (auto i = qos_timers.begin(); i != qos_timers.end(); )
+			if (i->second->group.expired())
+				i = qos_timers.erase(i);
+			else
+				++i;
+		auto &t = qos_timers[group.get()];
+		if (!t)
+			t = std::make_shared<qos_timer>(work_io_service, weak);
+		auto expiry = qos_group::clock::now() + wait;
+		if (t->pending && t->timer.expires_at() <= expiry)
+			return;
+		 /* cancels a wait still pending */
+		t->timer.expires_at(expiry);
+		t->pending = true;
+		t->timer.async_wait(
+			[this, t](const boost::system::error_code &ec)
+			{
+				if (ec == boost::asio::error::operation_aborted)
+					return;
+				{
+					std::lock_guard<std::mutex> lock(qos_mutex);
+					t->pending = false;
+				}
+				auto group = t->group.lock();
+				if (!group)
+					return;
+				qos_group::clock::duration wait;
+				group->release(wait);
+				if (wait != qos_group::clock::duration::zero())
+					arm_qos_timer(group, wait);
+			});
+	}
+	void enqueue(
+		const std::shared_ptr<serial_queue> &queue,
+		std::function<void ()> op)
+	{
+		bool start;
+		{
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->ops.push_back(std::move(op));
+			start = !queue->running;
+			queue->running = true;
+		}
+		if (start)
+			post_drain(queue);
+	}
+	void post_drain(std::shared_ptr<serial_queue> queue)
+	{
+		work_io_service.post(
+			[this, queue]()
+			{
+				std::function<void ()> op;
+				{
+					std::lock_guard<std::mutex> lock(queue->mutex);
+					op = std::move(queue->ops.front());
+					queue->ops.pop_front();
+				}
+				op();
+				bool more;
+				{
+					std::lock_guard<std::mutex> lock(queue->mutex);
+					more = !queue->ops.empty();
+					queue->running = more;
+				}
+				if (more)
+					post_drain(queue);
+			});
+	}
 	void shutdown_service() override final
 	{
+		 /* ops still waiting for their group are dropped rather than waited
+		  * for, they would only run after the io_service they complete on is
+		  * gone.
+		  */
+		std::map<const qos_group *, std::shared_ptr<qos_timer>> timers;
+		{
+			std::lock_guard<std::mutex> lock(qos_mutex);
+			stopping = true;
+			timers.swap(qos_timers);
+		}
+		for (auto &t : timers) {
+			if (auto group = t.second->group.lock())
+				group->drop(this);
+			std::lock_guard<std::mutex> lock(qos_mutex);
+			t.second->timer.cancel();
+		}
 		io_service_work.reset();
 		for (auto &t : threads)
 			t.join();
@@ -119,6 +374,9 @@ private:
 	boost::asio::io_service work_io_service;
 	std::unique_ptr<boost::asio::io_service::work> io_service_work;
 	std::vector<std::thread> threads;
+	std::mutex qos_mutex;
+	bool stopping = false;
+	std::map<const qos_group *, std::shared_ptr<qos_timer>> qos_timers;
 };
 
 
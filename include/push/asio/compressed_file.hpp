@@ -0,0 +1,212 @@
+ /* ----- <push/asio/compressed_file.hpp> ---------------------------------- */
+#ifndef push_asio_compressed_file_hpp_INCLUDED
+#define push_asio_compressed_file_hpp_INCLUDED
+
+#include <stdexcept>
+
+#include <push/asio/file.hpp>
+#include <push/asio/compressed_file_ops.hpp>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* a compressed view of a push::asio::file: data is appended in blocks of
+  * up to block_size bytes, each compressed with lz4 on a background_service
+  * worker, and read back at logical offsets.  A read only fetches and
+  * decompresses the blocks covering the requested range.
+  * 
+  * Every async_append is cut into blocks on its own: the data it was given
+  * ends in a partial block, which is never filled up by later appends.
+  * Small appends therefore produce small blocks that compress poorly and
+  * each cost a 12 byte header, so callers should append multiples of
+  * block_size (and only the final append of a file short of it).
+  * 
+  * The index of blocks is kept in memory and can be rebuilt from the block
+  * headers with async_load_index() or load_index(), with the block_size the
+  * file was written with (or a larger one).  Each block carries a crc32c;
+  * loading stops at the first block that is torn, fails its checksum or is
+  * larger than block_size (e.g. after a crash during an append), and
+  * truncates the file there, so the next append continues from the last
+  * good block.
+  * 
+  * Appends and reads are paced by the qos_group of the file, if it has
+  * one: an append is charged its uncompressed size, since the compressed
+  * one is only known once the work is done, a read the compressed bytes
+  * it fetches.
+  * 
+  * Like async_write on a socket, only one async_append may be outstanding
+  * at a time, and the compressed_file must outlive all of its operations.
+  */
+
+namespace push {
+namespace asio {
+
+class compressed_file {
+public:
+	typedef detail::compressed_file::block block;
+
+	explicit compressed_file(
+		file &f,
+		std::size_t block_size = 64 * 1024) :
+		f(f),
+		block_size_(block_size),
+		physical_size(0)
+	{
+		 /* block sizes have to fit the 31 bits of the block header */
+		if (block_size == 0 || block_size >= detail::compressed_file::stored_raw)
+			throw std::invalid_argument("compressed_file: invalid block_size");
+	}
+	std::size_t block_size() const
+	{
+		return block_size_;
+	}
+	 /* the uncompressed size */
+	std::uint64_t size() const
+	{
+		if (index.empty())
+			return 0;
+		return index.back().offset + index.back().size;
+	}
+	const std::vector<block> &blocks() const
+	{
+		return index;
+	}
+	 /* rebuilds the index from the block headers, on the calling thread */
+	void load_index(
+		boost::system::error_code &ec)
+	{
+		typedef detail::compressed_file::load_index_op Op;
+		std::vector<block> blocks;
+		std::uint64_t end = 0;
+		Op{f.native_handle(), block_size_}(ec, blocks, end);
+		if (!ec) {
+			index.swap(blocks);
+			physical_size = end;
+		}
+	}
+	void load_index()
+	{
+		boost::system::error_code ec;
+		load_index(ec);
+		if (ec) throw boost::system::system_error(ec);
+	}
+	 /* like load_index(), but reads the headers on a background_service
+	  * worker; no other operation may be outstanding meanwhile.
+	  * handler: void (boost::system::error_code)
+	  */
+	template <typename LoadHandler>
+	void async_load_index(
+		LoadHandler handler)
+	{
+		typedef detail::compressed_file::load_index_op Op;
+		struct load_handler {
+			compressed_file *self;
+			LoadHandler handler;
+			void operator()(
+				boost::system::error_code ec,
+				std::vector<block> &blocks,
+				std::uint64_t physical_size)
+			{
+				if (!ec) {
+					self->index.swap(blocks);
+					self->physical_size = physical_size;
+				}
+				handler(ec);
+			}
+		};
+		background().do_in_background(
+		    Op{f.native_handle(), block_size_},
+		    load_handler{this, handler});
+	}
+	 /* appends the data as full blocks plus, unless its size is a multiple
+	  * of block_size, one partial block.
+	  * handler: void (boost::system::error_code, std::size_t)
+	  */
+	template <typename ConstBufferSequence, typename WriteHandler>
+	void async_append(
+		const ConstBufferSequence &buffers,
+		WriteHandler handler)
+	{
+		typedef detail::compressed_file::append_op<ConstBufferSequence> Op;
+		struct append_handler {
+			compressed_file *self;
+			WriteHandler handler;
+			void operator()(
+				boost::system::error_code ec,
+				std::size_t bytes_transferred,
+				std::vector<block> &blocks)
+			{
+				if (!blocks.empty()) {
+					const block &b = blocks.back();
+					self->physical_size =
+						b.physical_offset +
+						detail::compressed_file::header_size +
+						b.stored_size;
+					self->index.insert(
+						self->index.end(),
+						blocks.begin(),
+						blocks.end());
+				}
+				handler(ec, bytes_transferred);
+			}
+		};
+		background().do_in_background(
+		    f.get_qos_group(),
+		    boost::asio::buffer_size(buffers),
+		    Op(f.native_handle(), size(), physical_size, block_size_, buffers),
+		    append_handler{this, handler});
+	}
+	 /* completes with the number of bytes read, which is short only at the
+	  * end of the data.  handler: void (boost::system::error_code, std::size_t)
+	  */
+	template <typename MutableBufferSequence, typename ReadHandler>
+	void async_read_at(
+		std::uint64_t offset,
+		const MutableBufferSequence &buffers,
+		ReadHandler handler)
+	{
+		typedef detail::compressed_file::read_at_op<MutableBufferSequence> Op;
+		std::uint64_t end = std::min<std::uint64_t>(
+			size(),
+			offset + boost::asio::buffer_size(buffers));
+		std::size_t size = 0;
+		std::uint64_t stored_size = 0;
+		std::vector<block> blocks;
+		if (offset < end) {
+			size = end - offset;
+			auto first = std::upper_bound(
+				index.begin(),
+				index.end(),
+				offset,
+				[](std::uint64_t o, const block &b) { return o < b.offset; });
+			for (auto i = first - 1; i != index.end() && i->offset < end; ++i) {
+				blocks.push_back(*i);
+				stored_size += i->stored_size;
+			}
+		}
+		background().do_in_background(
+		    f.get_qos_group(),
+		    stored_size,
+		    Op(
+			f.native_handle(),
+			offset,
+			size,
+			std::move(blocks),
+			buffers),
+		    handler);
+	}
+
+private:
+	background_service &background()
+	{
+		return boost::asio::use_service<background_service>(f.get_io_service());
+	}
+
+	file &f;
+	std::size_t block_size_;
+	std::vector<block> index;
+	std::uint64_t physical_size;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,353 @@
+ /* ----- <push/asio/compressed_file_ops.hpp> ------------------------------ */
+#ifndef push_asio_compressed_file_ops_hpp_INCLUDED
+#define push_asio_compressed_file_ops_hpp_INCLUDED
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <push/crc32c.hpp>
+#include <push/lz4.hpp>
+
+namespace push {
+namespace asio {
+namespace detail {
+namespace compressed_file {
+
+ /* ----- on disk format --------------------------------------------------- */
+ /* the file is a plain sequence of blocks, each one a header of three little
+  * endian 32 bit words, followed by the payload:
+  * 
+  * 	uncompressed size
+  * 	payload size, with stored_raw set if the payload is not compressed
+  * 	crc32c of the first two words and the payload
+  * 
+  * so the index can always be rebuilt by walking the headers, and a torn
+  * or overwritten block is told by its checksum.
+  */
+const std::size_t header_size = 12;
+const std::uint32_t stored_raw = 0x80000000;
+
+struct block {
+	std::uint64_t offset;
+	std::uint64_t physical_offset;
+	std::uint32_t size;
+	std::uint32_t stored_size;
+	bool compressed;
+};
+
+inline void put_le32(unsigned char *p, std::uint32_t v)
+{
+	p[0] = static_cast<unsigned char>(v);
+	p[1] = static_cast<unsigned char>(v >> 8);
+	p[2] = static_cast<unsigned char>(v >> 16);
+	p[3] = static_cast<unsigned char>(v >> 24);
+}
+
+inline std::uint32_t get_le32(const unsigned char *p)
+{
+	return
+		std::uint32_t(p[0]) |
+		std::uint32_t(p[1]) << 8 |
+		std::uint32_t(p[2]) << 16 |
+		std::uint32_t(p[3]) << 24;
+}
+
+ /* the checksum stored in the header h of a block with that payload */
+inline std::uint32_t block_crc(
+	const unsigned char *h,
+	const unsigned char *payload,
+	std::size_t stored_size)
+{
+	return crc32c(crc32c(0, h, 8), payload, stored_size);
+}
+
+ /* returns the number of bytes read, which is only short at end of file */
+inline std::size_t pread_full(
+	int fh,
+	void *data,
+	std::size_t size,
+	std::uint64_t offset,
+	boost::system::error_code &ec)
+{
+	auto p = static_cast<char *>(data);
+	std::size_t done = 0;
+	while (done < size) {
+		auto ret = ::pread(fh, p + done, size - done, offset + done);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			break;
+		}
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+inline void pwrite_full(
+	int fh,
+	const void *data,
+	std::size_t size,
+	std::uint64_t offset,
+	boost::system::error_code &ec)
+{
+	auto p = static_cast<const char *>(data);
+	std::size_t done = 0;
+	while (done < size) {
+		auto ret = ::pwrite(fh, p + done, size - done, offset + done);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			break;
+		}
+		done += ret;
+	}
+}
+
+template <typename MutableBufferSequence>
+void buffers_copy_at(
+	const MutableBufferSequence &buffer,
+	std::size_t position,
+	const void *data,
+	std::size_t size)
+{
+	auto p = static_cast<const char *>(data);
+	for (const auto &e : buffer) {
+		if (size == 0)
+			break;
+		std::size_t len = boost::asio::buffer_size(e);
+		if (position >= len) {
+			position -= len;
+			continue;
+		}
+		std::size_t n = std::min(size, len - position);
+		std::memcpy(
+			boost::asio::buffer_cast<char *>(e) + position,
+			p,
+			n);
+		position = 0;
+		p += n;
+		size -= n;
+	}
+}
+
+ /* walks the block headers from the start of the file.  The first block
+  * that is incomplete or does not check out (a crash during an append can
+  * leave a torn block, or zeros where the file was extended before the
+  * data reached the disk) ends the data, and the file is truncated there,
+  * so the next append does not leave stale bytes behind it.
+  */
+struct load_index_op {
+	typedef std::tuple<
+		boost::system::error_code,
+		std::vector<block>,
+		std::uint64_t
+		> parameter_type;
+	void operator()(
+		boost::system::error_code &ec,
+		std::vector<block> &blocks,
+		std::uint64_t &physical_size)
+	{
+		std::uint64_t offset = 0;
+		std::uint64_t physical_offset = 0;
+		std::vector<unsigned char> payload(block_size);
+		for (;;) {
+			unsigned char h[header_size];
+			std::size_t n = pread_full(fh, h, sizeof(h), physical_offset, ec);
+			if (ec)
+				return;
+			if (n != sizeof(h))
+				break;
+			block b;
+			b.offset = offset;
+			b.physical_offset = physical_offset;
+			b.size = get_le32(h);
+			b.stored_size = get_le32(h + 4) & ~stored_raw;
+			b.compressed = !(get_le32(h + 4) & stored_raw);
+			if (!valid(b))
+				break;
+			n = pread_full(fh, payload.data(), b.stored_size, physical_offset + header_size, ec);
+			if (ec)
+				return;
+			if (n != b.stored_size ||
+			    block_crc(h, payload.data(), b.stored_size) != get_le32(h + 8))
+				break;
+			blocks.push_back(b);
+			offset += b.size;
+			physical_offset += header_size + b.stored_size;
+		}
+		physical_size = physical_offset;
+
+		struct stat st;
+		if (::fstat(fh, &st) != 0) {
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			return;
+		}
+		if (std::uint64_t(st.st_size) > physical_size &&
+		    ::ftruncate(fh, physical_size) != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	 /* what append_op writes: compression only counts if it saved a byte */
+	bool valid(const block &b) const
+	{
+		if (b.size == 0 || b.size > block_size)
+			return false;
+		if (b.compressed)
+			return b.stored_size != 0 && b.stored_size < b.size;
+		return b.stored_size == b.size;
+	}
+	int fh;
+	std::size_t block_size;
+};
+
+template <typename ConstBufferSequence>
+struct append_op {
+	typedef std::tuple<
+		boost::system::error_code,
+		std::size_t,
+		std::vector<block>
+		> parameter_type;
+	append_op(
+		int fh,
+		std::uint64_t offset,
+		std::uint64_t physical_offset,
+		std::size_t block_size,
+		ConstBufferSequence buffer) :
+		fh(fh),
+		offset(offset),
+		physical_offset(physical_offset),
+		block_size(block_size),
+		buffer(buffer)
+	{
+	}
+	void operator()(
+		boost::system::error_code &ec,
+		std::size_t &bytes_transferred,
+		std::vector<block> &blocks)
+	{
+		std::vector<unsigned char> in(boost::asio::buffer_size(buffer));
+		boost::asio::buffer_copy(boost::asio::buffer(in), buffer);
+
+		std::vector<unsigned char> out;
+		out.reserve(
+			(in.size() / block_size + 1) * header_size +
+			lz4_compress_bound(in.size()));
+		for (std::size_t pos = 0; pos < in.size(); pos += block_size) {
+			std::size_t n = std::min(block_size, in.size() - pos);
+			std::size_t at = out.size();
+			out.resize(at + header_size + lz4_compress_bound(n));
+			std::size_t cn = lz4_compress(
+				&in[pos], n,
+				&out[at + header_size], n - 1);
+			block b;
+			b.offset = offset + pos;
+			b.physical_offset = physical_offset + at;
+			b.size = static_cast<std::uint32_t>(n);
+			b.compressed = cn != 0;
+			if (!b.compressed) {
+				std::memcpy(&out[at + header_size], &in[pos], n);
+				cn = n;
+			}
+			b.stored_size = static_cast<std::uint32_t>(cn);
+			put_le32(&out[at], b.size);
+			put_le32(&out[at + 4], b.stored_size | (b.compressed ? 0 : stored_raw));
+			put_le32(&out[at + 8], block_crc(&out[at], &out[at + header_size], cn));
+			out.resize(at + header_size + cn);
+			blocks.push_back(b);
+		}
+		pwrite_full(fh, out.data(), out.size(), physical_offset, ec);
+		if (ec)
+			blocks.clear();
+		else
+			bytes_transferred = in.size();
+	}
+	int fh;
+	std::uint64_t offset;
+	std::uint64_t physical_offset;
+	std::size_t block_size;
+	ConstBufferSequence buffer;
+};
+
+ /* blocks are exactly those covering [offset, offset + size); as they were
+  * appended back to back, a single read fetches all of them.
+  */
+template <typename MutableBufferSequence>
+struct read_at_op {
+	typedef std::tuple<boost::system::error_code, std::size_t> parameter_type;
+	read_at_op(
+		int fh,
+		std::uint64_t offset,
+		std::size_t size,
+		std::vector<block> blocks,
+		MutableBufferSequence buffer) :
+		fh(fh),
+		offset(offset),
+		size(size),
+		blocks(std::move(blocks)),
+		buffer(buffer)
+	{
+	}
+	void operator()(boost::system::error_code &ec, std::size_t &bytes_transferred)
+	{
+		if (blocks.empty())
+			return;
+		const block &first = blocks.front();
+		const block &last = blocks.back();
+		std::uint64_t begin = first.physical_offset;
+		std::uint64_t end = last.physical_offset + header_size + last.stored_size;
+		std::vector<unsigned char> in(end - begin);
+		if (pread_full(fh, in.data(), in.size(), begin, ec) != in.size()) {
+			if (!ec)
+				ec = boost::system::error_code(EBADMSG, boost::system::system_category());
+			return;
+		}
+
+		std::vector<unsigned char> raw;
+		for (const auto &b : blocks) {
+			const unsigned char *h = &in[b.physical_offset - begin];
+			std::uint32_t stored = b.stored_size | (b.compressed ? 0 : stored_raw);
+			const unsigned char *data = h + header_size;
+			if (get_le32(h) != b.size || get_le32(h + 4) != stored ||
+			    block_crc(h, data, b.stored_size) != get_le32(h + 8)) {
+				ec = boost::system::error_code(EBADMSG, boost::system::system_category());
+				return;
+			}
+			if (b.compressed) {
+				raw.resize(b.size);
+				if (lz4_decompress(data, b.stored_size, raw.data(), raw.size()) != b.size) {
+					ec = boost::system::error_code(EBADMSG, boost::system::system_category());
+					return;
+				}
+				data = raw.data();
+			}
+			std::uint64_t from = std::max(offset, b.offset);
+			std::uint64_t to = std::min(offset + size, b.offset + b.size);
+			buffers_copy_at(
+				buffer,
+				from - offset,
+				data + (from - b.offset),
+				to - from);
+		}
+		bytes_transferred = size;
+	}
+	int fh;
+	std::uint64_t offset;
+	std::size_t size;
+	std::vector<block> blocks;
+	MutableBufferSequence buffer;
+};
+
+}
+}
+}
+}
+
+#endif
@@ -5,12 +5,48 @@
 
 namespace push {
 namespace asio {
+
+ /* one entry of async_read_ranges(); bytes_transferred is filled in on
+  * completion and is short only at end of file.
+  */
+typedef detail::file_service::read_range read_range;
+
+typedef detail::file_service::directory_entry directory_entry;
+
+ /* a range of a sparse file backed by data */
+typedef detail::file_service::extent extent;
 	
 class file : public boost::asio::basic_io_object<file_service> {
 public:
 	explicit file(boost::asio::io_service &io_service) :
 		boost::asio::basic_io_object<file_service>(io_service)
 	{
+	}
+	 /* paces the asynchronous reads and writes, positional or at the file
+	  * offset, copies into this file, fdatasync and fallocate by the limits
+	  * of group, which can be shared with other files.  async_read,
+	  * async_write and async_seek keep their order, they join the cursor
+	  * queue only once the group admitted them.  Operations of a file with
+	  * a group always go through the background_service, even where a page
+	  * cache hit could have been served inline.  Pass nullptr to remove the
+	  * limits.
+	  */
+	void set_qos_group(
+		std::shared_ptr<qos_group> group)
+	{
+		this->get_service().set_qos_group(
+			this->get_implementation(),
+			std::move(group));
+	}
+	const std::shared_ptr<qos_group> &get_qos_group()
+	{
+		return this->get_service().get_qos_group(
+			this->get_implementation());
+	}
+	int native_handle()
+	{
+		return this->get_service().native_handle(
+			this->get_implementation());
 	}
 	void open(
 		const boost::filesystem::path &path,
@@ -195,6 +231,216 @@ public:
 			offset,
 			buffers,
 			handler);
+	}
+	 /* like async_write_some_at, the handler additionally receives the
+	  * crc32c of the bytes written:
+	  * void (boost::system::error_code, std::size_t, std::uint32_t)
+	  */
+	template <typename ConstBufferSequence, typename WriteHandler>
+	void async_write_some_at_checksum(
+		std::uint64_t offset,
+		const ConstBufferSequence &buffers,
+		WriteHandler handler)
+	{
+		return this->get_service().async_write_some_at_checksum(
+			this->get_implementation(),
+			offset,
+			buffers,
+			handler);
+	}
+	 /* like async_read_at, but completes with EBADMSG if the crc32c of the
+	  * bytes read does not match expected_crc.
+	  */
+	template <typename MutableBufferSequence, typename ReadHandler>
+	void async_read_at_verify(
+		std::uint64_t offset,
+		const MutableBufferSequence &buffers,
+		std::uint32_t expected_crc,
+		ReadHandler handler)
+	{
+		return this->get_service().async_read_at_verify(
+			this->get_implementation(),
+			offset,
+			buffers,
+			expected_crc,
+			handler);
+	}
+	 /* reads all ranges, merging ranges at most max_gap bytes apart into
+	  * a single preadv, and issuing the merged reads in parallel.
+	  * handler: void (boost::system::error_code, std::vector<read_range>)
+	  */
+	template <typename ReadHandler>
+	void async_read_ranges(
+		std::vector<read_range> ranges,
+		std::uint64_t max_gap,
+		ReadHandler handler)
+	{
+		return this->get_service().async_read_ranges(
+			this->get_implementation(),
+			std::move(ranges),
+			max_gap,
+			handler);
+	}
+	template <typename ReadHandler>
+	void async_read_ranges(
+		std::vector<read_range> ranges,
+		ReadHandler handler)
+	{
+		async_read_ranges(std::move(ranges), 4096, handler);
+	}
+	 /* copies size bytes from src into this file, by reflinking the range
+	  * if the filesystem supports it, with copy_file_range otherwise, and by
+	  * reading and writing in the background as a last resort.  Holes in
+	  * src are punched into this file instead of being copied.
+	  * handler: void (boost::system::error_code, std::uint64_t bytes_copied)
+	  */
+	template <typename CopyHandler>
+	void async_copy_range(
+		file &src,
+		std::uint64_t src_offset,
+		std::uint64_t dst_offset,
+		std::uint64_t size,
+		CopyHandler handler)
+	{
+		return this->get_service().async_copy_range(
+			src.get_implementation(),
+			src_offset,
+			this->get_implementation(),
+			dst_offset,
+			size,
+			handler);
+	}
+	 /* progress: void (std::uint64_t bytes_copied), called on the io_service
+	  * while the copy runs.
+	  */
+	template <typename CopyHandler, typename ProgressHandler>
+	void async_copy_range(
+		file &src,
+		std::uint64_t src_offset,
+		std::uint64_t dst_offset,
+		std::uint64_t size,
+		CopyHandler handler,
+		ProgressHandler progress)
+	{
+		return this->get_service().async_copy_range(
+			src.get_implementation(),
+			src_offset,
+			this->get_implementation(),
+			dst_offset,
+			size,
+			handler,
+			progress);
+	}
+	 /* deallocates [offset, offset + size), which then reads as zeros; the
+	  * file size does not change.
+	  * handler: void (boost::system::error_code)
+	  */
+	template <typename Handler>
+	void async_punch_hole(
+		std::uint64_t offset,
+		std::uint64_t size,
+		Handler handler)
+	{
+		return this->get_service().async_fallocate(
+			this->get_implementation(),
+			FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			offset,
+			size,
+			handler);
+	}
+	 /* zeros [offset, offset + size) without writing the zeros, extending
+	  * the file if needed.
+	  * handler: void (boost::system::error_code)
+	  */
+	template <typename Handler>
+	void async_zero_range(
+		std::uint64_t offset,
+		std::uint64_t size,
+		Handler handler)
+	{
+		return this->get_service().async_fallocate(
+			this->get_implementation(),
+			FALLOC_FL_ZERO_RANGE,
+			offset,
+			size,
+			handler);
+	}
+	 /* the data extents in [offset, offset + size), everything else is a
+	  * hole.
+	  * handler: void (boost::system::error_code, std::vector<extent>)
+	  */
+	template <typename ExtentsHandler>
+	void async_extents(
+		std::uint64_t offset,
+		std::uint64_t size,
+		ExtentsHandler handler)
+	{
+		return this->get_service().async_extents(
+			this->get_implementation(),
+			offset,
+			size,
+			handler);
+	}
+	 /* fills the buffers up to the end of the file, reading only the data
+	  * extents and zero filling the holes in memory.
+	  * handler: void (boost::system::error_code, std::size_t)
+	  */
+	template <typename MutableBufferSequence, typename ReadHandler>
+	void async_read_sparse_at(
+		std::uint64_t offset,
+		const MutableBufferSequence &buffers,
+		ReadHandler handler)
+	{
+		return this->get_service().async_read_sparse_at(
+			this->get_implementation(),
+			offset,
+			buffers,
+			handler);
+	}
+	 /* handler: void (boost::system::error_code, struct stat) */
+	template <typename StatHandler>
+	void async_stat(
+		StatHandler handler)
+	{
+		return this->get_service().async_stat(
+			this->get_implementation(),
+			handler);
+	}
+	 /* for a file opened with O_DIRECTORY: reads the next batch of entries,
+	  * as many as getdents64 returns into a buffer of buffer_size bytes.  An
+	  * empty batch signals the end of the directory.  getdents64 reads at the
+	  * directory offset, so batches are read in the order they were
+	  * requested, like async_read.
+	  * handler: void (boost::system::error_code, std::vector<directory_entry>)
+	  */
+	template <typename ReadHandler>
+	void async_read_directory(
+		std::size_t buffer_size,
+		ReadHandler handler)
+	{
+		return this->get_service().async_read_directory(
+			this->get_implementation(),
+			buffer_size,
+			handler);
+	}
+	template <typename ReadHandler>
+	void async_read_directory(
+		ReadHandler handler)
+	{
+		async_read_directory(1 << 20, handler);
+	}
+	 /* like async_read and async_write, async_seek runs in submission order
+	  * with the other ops using the file offset.
+	  */
+	template <typename SeekHandler>
+	void async_seek(
+		std::uint64_t offset,
+		SeekHandler handler)
+	{
+		return this->get_service().async_seek(
+			this->get_implementation(),
+			offset,
+			handler);
 	}
 	void seek(
 		std::uint64_t offset,
@@ -215,6 +461,31 @@ public:
 
 };
 
+template <typename CopyHandler>
+void async_copy_range(
+	file &src,
+	std::uint64_t src_offset,
+	file &dst,
+	std::uint64_t dst_offset,
+	std::uint64_t size,
+	CopyHandler handler)
+{
+	dst.async_copy_range(src, src_offset, dst_offset, size, handler);
+}
+
+template <typename CopyHandler, typename ProgressHandler>
+void async_copy_range(
+	file &src,
+	std::uint64_t src_offset,
+	file &dst,
+	std::uint64_t dst_offset,
+	std::uint64_t size,
+	CopyHandler handler,
+	ProgressHandler progress)
+{
+	dst.async_copy_range(src, src_offset, dst_offset, size, handler, progress);
+}
+
 }
 }
 
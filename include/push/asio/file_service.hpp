@@ -3,6 +3,7 @@
 #define push_asio_file_service_hpp_INCLUDED
 
 #include <atomic>
+#include <mutex>
 
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
@@ -17,6 +18,17 @@ class file_service : public boost::asio::io_service::service {
 public:
 	struct implementation_type {
 		int fh;
+		 /* cleared once RWF_NOWAIT turns out not to be supported; atomic as
+		  * positional ops may be started from several threads at once.
+		  */
+		std::atomic<bool> read_nowait;
+		std::atomic<bool> write_nowait;
+		 /* orders the ops using the file offset (async_read, async_write,
+		  * async_seek); positional ops bypass it.
+		  */
+		std::shared_ptr<serial_queue> cursor_queue;
+		 /* paces the ops that do I/O, may be null */
+		std::shared_ptr<qos_group> qos;
 	};
 
 	static boost::asio::io_service::id id;
@@ -31,12 +43,31 @@ public:
 	void construct(implementation_type &impl)
 	{
 		impl.fh = -1;
+		impl.read_nowait.store(true, std::memory_order_relaxed);
+		impl.write_nowait.store(true, std::memory_order_relaxed);
+		impl.cursor_queue = std::make_shared<serial_queue>();
 	}
 	void destroy(implementation_type &impl)
 	{
 		if (impl.fh != -1)
 			::close(impl.fh);
 	}
+	void set_qos_group(
+		implementation_type &impl,
+		std::shared_ptr<qos_group> group)
+	{
+		impl.qos = std::move(group);
+	}
+	const std::shared_ptr<qos_group> &get_qos_group(
+		implementation_type &impl)
+	{
+		return impl.qos;
+	}
+	int native_handle(
+		implementation_type &impl)
+	{
+		return impl.fh;
+	}
 	void open(
 		implementation_type &impl,
 		const boost::filesystem::path &path,
@@ -95,6 +126,8 @@ public:
 	{
 		typedef detail::file_service::fdatasync_op<implementation_type> Op;
 		do_in_background(
+		    impl.qos,
+		    0,
 		    Op(impl),
 		    handler);
 	}
@@ -128,7 +161,9 @@ public:
 			implementation_type,
 			ConstBufferSequence
 			> Op;
-		do_in_background(
+		do_inline_or_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
 		    Op(impl, offset, buffers),
 		    handler);
 	}
@@ -160,6 +195,9 @@ public:
 			ConstBufferSequence
 			> Op;
 		do_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
+		    impl.cursor_queue,
 		    Op(impl, buffers),
 		    handler);
 	}
@@ -193,7 +231,9 @@ public:
 			implementation_type,
 			MutableBufferSequence
 			> Op;
-		do_in_background(
+		do_inline_or_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
 		    Op(impl, offset, buffers),
 		    handler);
 	}
@@ -208,6 +248,9 @@ public:
 			MutableBufferSequence
 			> Op;
 		do_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
+		    impl.cursor_queue,
 		    Op(impl, buffers),
 		    handler);
 	}
@@ -222,10 +265,275 @@ public:
 			implementation_type,
 			MutableBufferSequence
 			> Op;
+		do_inline_or_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
+		    Op(impl, offset, buffers),
+		    handler);
+	}
+	template <typename ConstBufferSequence, typename WriteHandler>
+	void async_write_some_at_checksum(
+		implementation_type &impl,
+		std::uint64_t offset,
+		const ConstBufferSequence &buffers,
+		WriteHandler handler)
+	{
+		typedef detail::file_service::write_at_checksum_op<
+			implementation_type,
+			ConstBufferSequence
+			> Op;
+		do_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
+		    Op(impl, offset, buffers),
+		    handler);
+	}
+	template <typename MutableBufferSequence, typename ReadHandler>
+	void async_read_at_verify(
+		implementation_type &impl,
+		std::uint64_t offset,
+		const MutableBufferSequence &buffers,
+		std::uint32_t expected_crc,
+		ReadHandler handler)
+	{
+		typedef detail::file_service::read_at_verify_op<
+			implementation_type,
+			MutableBufferSequence
+			> Op;
+		do_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
+		    Op(impl, offset, buffers, expected_crc),
+		    handler);
+	}
+	template <typename ReadHandler>
+	void async_read_ranges(
+		implementation_type &impl,
+		std::vector<detail::file_service::read_range> ranges,
+		std::uint64_t max_gap,
+		ReadHandler handler)
+	{
+		typedef detail::file_service::read_range read_range;
+		typedef detail::file_service::read_ranges_op<
+			implementation_type
+			> Op;
+		struct state {
+			std::shared_ptr<std::vector<read_range>> ranges;
+			std::atomic<std::size_t> pending;
+			std::mutex mutex;
+			boost::system::error_code ec;
+			ReadHandler handler;
+			state(ReadHandler handler) : handler(handler) { }
+		};
+		struct completion {
+			std::shared_ptr<state> s;
+			void operator()(boost::system::error_code ec)
+			{
+				if (ec) {
+					std::lock_guard<std::mutex> lock(s->mutex);
+					if (!s->ec)
+						s->ec = ec;
+				}
+				if (--s->pending == 0)
+					s->handler(s->ec, std::move(*s->ranges));
+			}
+		};
+
+		auto groups = detail::file_service::merge_ranges(ranges, max_gap);
+		if (groups.empty()) {
+			get_io_service().post(std::bind(
+				handler,
+				boost::system::error_code(),
+				std::vector<read_range>()));
+			return;
+		}
+		auto s = std::make_shared<state>(handler);
+		s->ranges = std::make_shared<std::vector<read_range>>(std::move(ranges));
+		s->pending = groups.size();
+		for (auto &g : groups) {
+			const auto &first = (*s->ranges)[g.front()];
+			const auto &last = (*s->ranges)[g.back()];
+			std::uint64_t span =
+				last.offset + boost::asio::buffer_size(last.buffer) -
+				first.offset;
+			do_in_background(
+			    impl.qos,
+			    span,
+			    Op(impl, s->ranges, std::move(g)),
+			    completion{s});
+		}
+	}
+	template <typename CopyHandler>
+	void async_copy_range(
+		implementation_type &src,
+		std::uint64_t src_offset,
+		implementation_type &dst,
+		std::uint64_t dst_offset,
+		std::uint64_t size,
+		CopyHandler handler)
+	{
+		typedef detail::file_service::copy_range_op<
+			implementation_type
+			> Op;
+		do_in_background(
+		    dst.qos,
+		    size,
+		    Op(src, src_offset, dst, dst_offset, size, typename Op::progress_type()),
+		    handler);
+	}
+	template <typename CopyHandler, typename ProgressHandler>
+	void async_copy_range(
+		implementation_type &src,
+		std::uint64_t src_offset,
+		implementation_type &dst,
+		std::uint64_t dst_offset,
+		std::uint64_t size,
+		CopyHandler handler,
+		ProgressHandler progress)
+	{
+		typedef detail::file_service::copy_range_op<
+			implementation_type
+			> Op;
+		auto &io_service = get_io_service();
+		do_in_background(
+		    dst.qos,
+		    size,
+		    Op(
+			src,
+			src_offset,
+			dst,
+			dst_offset,
+			size,
+			[&io_service, progress](std::uint64_t bytes_copied)
+			{
+				io_service.post(std::bind(progress, bytes_copied));
+			}),
+		    handler);
+	}
+	template <typename Handler>
+	void async_fallocate(
+		implementation_type &impl,
+		int mode,
+		std::uint64_t offset,
+		std::uint64_t size,
+		Handler handler)
+	{
+		typedef detail::file_service::fallocate_op<implementation_type> Op;
+		do_in_background(
+		    impl.qos,
+		    0,
+		    Op(impl, mode, offset, size),
+		    handler);
+	}
+	template <typename ExtentsHandler>
+	void async_extents(
+		implementation_type &impl,
+		std::uint64_t offset,
+		std::uint64_t size,
+		ExtentsHandler handler)
+	{
+		typedef detail::file_service::extents_op<implementation_type> Op;
+		do_in_background(
+		    Op(impl, offset, size),
+		    handler);
+	}
+	template <typename MutableBufferSequence, typename ReadHandler>
+	void async_read_sparse_at(
+		implementation_type &impl,
+		std::uint64_t offset,
+		const MutableBufferSequence &buffers,
+		ReadHandler handler)
+	{
+		typedef detail::file_service::read_sparse_at_op<
+			implementation_type,
+			MutableBufferSequence
+			> Op;
 		do_in_background(
+		    impl.qos,
+		    boost::asio::buffer_size(buffers),
 		    Op(impl, offset, buffers),
 		    handler);
 	}
+	template <typename StatHandler>
+	void async_stat(
+		implementation_type &impl,
+		StatHandler handler)
+	{
+		typedef detail::file_service::fstat_op<implementation_type> Op;
+		do_in_background(
+		    Op(impl),
+		    handler);
+	}
+	template <typename StatHandler>
+	void async_stat(
+		const boost::filesystem::path &path,
+		StatHandler handler)
+	{
+		typedef detail::file_service::stat_op Op;
+		do_in_background(
+		    Op(path),
+		    handler);
+	}
+#ifdef STATX_BASIC_STATS
+	template <typename StatHandler>
+	void async_statx(
+		const boost::filesystem::path &path,
+		int flags,
+		unsigned mask,
+		StatHandler handler)
+	{
+		typedef detail::file_service::statx_op Op;
+		do_in_background(
+		    Op(path, flags, mask),
+		    handler);
+	}
+#endif
+	template <typename RenameHandler>
+	void async_rename(
+		const boost::filesystem::path &from,
+		const boost::filesystem::path &to,
+		RenameHandler handler)
+	{
+		typedef detail::file_service::rename_op Op;
+		do_in_background(
+		    Op(from, to),
+		    handler);
+	}
+	template <typename UnlinkHandler>
+	void async_unlink(
+		const boost::filesystem::path &path,
+		UnlinkHandler handler)
+	{
+		typedef detail::file_service::unlink_op Op;
+		do_in_background(
+		    Op(path),
+		    handler);
+	}
+	template <typename MkdirHandler>
+	void async_mkdir(
+		const boost::filesystem::path &path,
+		mode_t mode,
+		MkdirHandler handler)
+	{
+		typedef detail::file_service::mkdir_op Op;
+		do_in_background(
+		    Op(path, mode),
+		    handler);
+	}
+	template <typename ReadHandler>
+	void async_read_directory(
+		implementation_type &impl,
+		std::size_t buffer_size,
+		ReadHandler handler)
+	{
+		typedef detail::file_service::read_directory_op<implementation_type> Op;
+		do_in_background(
+		    impl.qos,
+		    0,
+		    impl.cursor_queue,
+		    Op(impl, buffer_size),
+		    handler);
+	}
 	void seek(
 		implementation_type &impl,
 		std::uint64_t offset,
@@ -239,8 +547,57 @@ public:
 			offset);
 		op(ec);
 	}
+	template <typename SeekHandler>
+	void async_seek(
+		implementation_type &impl,
+		std::uint64_t offset,
+		SeekHandler handler)
+	{
+		typedef detail::file_service::seek_op<
+			implementation_type
+			> Op;
+		do_in_background(
+		    impl.qos,
+		    0,
+		    impl.cursor_queue,
+		    Op(impl, offset),
+		    handler);
+	}
 	
 private:
+	 /* for ops that can complete without blocking (page cache hits), try
+	  * that first and only go to the background if it did not transfer
+	  * everything.  The handler is still posted, never called from within
+	  * the initiating function.
+	  */
+	template <typename Op, typename Handler>
+	void do_inline_or_in_background(
+		const std::shared_ptr<qos_group> &group,
+		std::uint64_t bytes,
+		Op op,
+		Handler handler)
+	{
+		typedef detail::background_service::completion<
+			typename Op::parameter_type,
+			Handler> Completion;
+		 /* everything of a file with qos limits is paced by its group */
+		if (group) {
+			do_in_background(group, bytes, op, handler);
+			return;
+		}
+		using trace::trace_info;
+		Completion c(handler);
+		c.trace_id = trace::submit(trace_info(op));
+		trace::record(c.trace_id, trace::event_type::nowait_begin);
+		bool done = op.try_nowait(std::get<0>(c.parameter), std::get<1>(c.parameter));
+		trace::record(c.trace_id, trace::event_type::nowait_end);
+		if (done) {
+			get_io_service().post(c);
+		} else {
+			auto &bs = boost::asio::use_service<push::asio::background_service>(get_io_service());
+			bs.do_in_background(op, handler, c.trace_id);
+		}
+	}
 	template <typename Op, typename Handler>
 	void do_in_background(
 		Op op,
@@ -249,6 +606,36 @@ private:
 		auto &bs = boost::asio::use_service<push::asio::background_service>(get_io_service());
 		bs.do_in_background(op, handler);
 	}
+	template <typename Op, typename Handler>
+	void do_in_background(
+		const std::shared_ptr<serial_queue> &queue,
+		Op op,
+		Handler handler)
+	{
+		auto &bs = boost::asio::use_service<push::asio::background_service>(get_io_service());
+		bs.do_in_background(queue, op, handler);
+	}
+	template <typename Op, typename Handler>
+	void do_in_background(
+		const std::shared_ptr<qos_group> &group,
+		std::uint64_t bytes,
+		Op op,
+		Handler handler)
+	{
+		auto &bs = boost::asio::use_service<push::asio::background_service>(get_io_service());
+		bs.do_in_background(group, bytes, op, handler);
+	}
+	template <typename Op, typename Handler>
+	void do_in_background(
+		const std::shared_ptr<qos_group> &group,
+		std::uint64_t bytes,
+		const std::shared_ptr<serial_queue> &queue,
+		Op op,
+		Handler handler)
+	{
+		auto &bs = boost::asio::use_service<push::asio::background_service>(get_io_service());
+		bs.do_in_background(group, bytes, queue, op, handler);
+	}
 
 	void shutdown_service() override final
 	{
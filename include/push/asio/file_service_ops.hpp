@@ -2,15 +2,69 @@
 #ifndef push_asio_file_service_ops_hpp_INCLUDED
 #define push_asio_file_service_ops_hpp_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
 #include <tuple>
 
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
 #include <push/apply_tuple.hpp>
+#include <push/crc32c.hpp>
+#include <push/asio/trace.hpp>
 
 namespace push {
 namespace asio {
 namespace detail {
 namespace file_service {
 
+template <typename BufferSequence>
+std::vector<iovec> make_iovecs(const BufferSequence &buffer)
+{
+	std::vector<iovec> buffers;
+	for (const auto &e : buffer) {
+		iovec iov;
+		iov.iov_base = const_cast<void *>(boost::asio::buffer_cast<const void *>(e));
+		iov.iov_len = boost::asio::buffer_size(e);
+		buffers.push_back(iov);
+	}
+	return buffers;
+}
+
+ /* RWF_NOWAIT makes preadv2/pwritev2 fail with EAGAIN instead of blocking,
+  * i.e. it only succeeds if the data is in the page cache.  Only a transfer
+  * of the full size completes inline: a short one (partly cached, or at end
+  * of file) and any error go to the background, which redoes the whole op
+  * and reports real errors.  EOPNOTSUPP and EINVAL mean the file or kernel
+  * does not support the flag, so stop trying until the file is reopened.
+  */
+inline bool nowait_result(
+	std::atomic<bool> &enabled,
+	ssize_t ret,
+	std::size_t size,
+	boost::system::error_code &ec,
+	std::size_t &bytes_transferred)
+{
+	if (ret == -1) {
+		if (errno == EOPNOTSUPP || errno == EINVAL)
+			enabled.store(false, std::memory_order_relaxed);
+		return false;
+	}
+	if (std::size_t(ret) != size)
+		return false;
+	ec = boost::system::error_code();
+	bytes_transferred = ret;
+	return true;
+}
+
 template <typename ImplementationType>
 struct open_op {
 	typedef std::tuple<boost::system::error_code> parameter_type;
@@ -32,10 +86,13 @@ struct open_op {
 			path.native().c_str(),
 			flags,
 			mode);
-		if (fh == -1)
+		if (fh == -1) {
 			ec = boost::system::error_code(errno, boost::system::system_category());
-		else
+		} else {
 			this->impl.fh = fh;
+			this->impl.read_nowait.store(true, std::memory_order_relaxed);
+			this->impl.write_nowait.store(true, std::memory_order_relaxed);
+		}
 	}
 	
 	ImplementationType &impl;
@@ -106,6 +163,21 @@ struct write_at_op {
 		auto ret = pwritev(this->impl.fh, &buffers[0], buffers.size(), offset);
 		if (ret == -1) ec = boost::system::error_code(errno, boost::system::system_category());
 		bytes_transferred = ret;
+	}
+	 /* try to complete on the calling thread without blocking */
+	bool try_nowait(boost::system::error_code &ec, std::size_t &bytes_transferred)
+	{
+#ifdef RWF_NOWAIT
+		if (!this->impl.write_nowait.load(std::memory_order_relaxed))
+			return false;
+		auto buffers = make_iovecs(buffer);
+		auto ret = pwritev2(this->impl.fh, &buffers[0], buffers.size(), offset, RWF_NOWAIT);
+		return nowait_result(this->impl.write_nowait, ret, boost::asio::buffer_size(buffer), ec, bytes_transferred);
+#else
+		(void)ec;
+		(void)bytes_transferred;
+		return false;
+#endif
 	}
 	ImplementationType &impl;
 	std::uint64_t       offset;
@@ -163,12 +235,90 @@ struct read_at_op {
 		auto ret = preadv(this->impl.fh, &buffers[0], buffers.size(), offset);
 		if (ret == -1) ec = boost::system::error_code(errno, boost::system::system_category());
 		bytes_transferred = ret;
+	}
+	 /* try to complete on the calling thread from the page cache */
+	bool try_nowait(boost::system::error_code &ec, std::size_t &bytes_transferred)
+	{
+#ifdef RWF_NOWAIT
+		if (!this->impl.read_nowait.load(std::memory_order_relaxed))
+			return false;
+		auto buffers = make_iovecs(buffer);
+		auto ret = preadv2(this->impl.fh, &buffers[0], buffers.size(), offset, RWF_NOWAIT);
+		return nowait_result(this->impl.read_nowait, ret, boost::asio::buffer_size(buffer), ec, bytes_transferred);
+#else
+		(void)ec;
+		(void)bytes_transferred;
+		return false;
+#endif
 	}
 	ImplementationType &impl;
 	std::uint64_t offset;
 	MutableBufferSequence buffer;
 };
 
+template <typename BufferSequence>
+std::uint32_t buffers_crc32c(
+	const BufferSequence &buffer,
+	std::size_t size)
+{
+	std::uint32_t crc = 0;
+	for (const auto &e : buffer) {
+		if (size == 0)
+			break;
+		std::size_t n = std::min(size, boost::asio::buffer_size(e));
+		crc = push::crc32c(crc, boost::asio::buffer_cast<const void *>(e), n);
+		size -= n;
+	}
+	return crc;
+}
+
+ /* the checksum covers the bytes actually written, so a short write reports
+  * the crc of the prefix that made it to the file.
+  */
+template <typename ImplementationType, typename ConstBufferSequence>
+struct write_at_checksum_op {
+	typedef std::tuple<boost::system::error_code, std::size_t, std::uint32_t> parameter_type;
+	write_at_checksum_op(
+		ImplementationType &impl,
+		std::uint64_t offset,
+		ConstBufferSequence buffer) :
+		write(impl, offset, buffer)
+	{
+	}
+	void operator()(
+		boost::system::error_code &ec,
+		std::size_t &bytes_transferred,
+		std::uint32_t &crc)
+	{
+		write(ec, bytes_transferred);
+		if (!ec)
+			crc = buffers_crc32c(write.buffer, bytes_transferred);
+	}
+	write_at_op<ImplementationType, ConstBufferSequence> write;
+};
+
+template <typename ImplementationType, typename MutableBufferSequence>
+struct read_at_verify_op {
+	typedef std::tuple<boost::system::error_code, std::size_t> parameter_type;
+	read_at_verify_op(
+		ImplementationType &impl,
+		std::uint64_t offset,
+		MutableBufferSequence buffer,
+		std::uint32_t expected_crc) :
+		read(impl, offset, buffer),
+		expected_crc(expected_crc)
+	{
+	}
+	void operator()(boost::system::error_code &ec, std::size_t &bytes_transferred)
+	{
+		read(ec, bytes_transferred);
+		if (!ec && buffers_crc32c(read.buffer, bytes_transferred) != expected_crc)
+			ec = boost::system::error_code(EBADMSG, boost::system::system_category());
+	}
+	read_at_op<ImplementationType, MutableBufferSequence> read;
+	std::uint32_t expected_crc;
+};
+
 template <typename ImplementationType, typename MutableBufferSequence>
 struct read_op {
 	typedef std::tuple<boost::system::error_code, std::size_t> parameter_type;
@@ -196,6 +346,698 @@ struct read_op {
 	MutableBufferSequence buffer;
 };
 
+struct read_range {
+	std::uint64_t offset;
+	boost::asio::mutable_buffer buffer;
+	std::size_t bytes_transferred;
+};
+
+ /* groups the ranges (by index) into runs that can be read with one preadv:
+  * sorted by offset, not overlapping, separated by at most max_gap bytes
+  * and not exceeding IOV_MAX buffers including the ones for the gaps.
+  */
+inline std::vector<std::vector<std::size_t>> merge_ranges(
+	const std::vector<read_range> &ranges,
+	std::uint64_t max_gap)
+{
+	std::vector<std::size_t> order(ranges.size());
+	for (std::size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(
+		order.begin(),
+		order.end(),
+		[&ranges](std::size_t a, std::size_t b)
+		{
+			return ranges[a].offset < ranges[b].offset;
+		});
+
+	std::vector<std::vector<std::size_t>> groups;
+	std::uint64_t end = 0;
+	std::size_t iovecs = 0;
+	for (auto i : order) {
+		const auto &r = ranges[i];
+		bool merge =
+			!groups.empty() &&
+			r.offset >= end &&
+			r.offset - end <= max_gap &&
+			iovecs + 2 <= IOV_MAX;
+		if (merge) {
+			iovecs += r.offset > end ? 2 : 1;
+		} else {
+			groups.emplace_back();
+			iovecs = 1;
+		}
+		groups.back().push_back(i);
+		end = r.offset + boost::asio::buffer_size(r.buffer);
+	}
+	return groups;
+}
+
+ /* reads one group from merge_ranges(), sending the bytes between the
+  * ranges to a scratch buffer.
+  */
+template <typename ImplementationType>
+struct read_ranges_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	read_ranges_op(
+		ImplementationType &impl,
+		std::shared_ptr<std::vector<read_range>> ranges,
+		std::vector<std::size_t> group) :
+		impl(impl),
+		ranges(ranges),
+		group(std::move(group))
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		auto &r = *ranges;
+		std::uint64_t max_gap = 0;
+		for (std::size_t i = 1; i < group.size(); ++i) {
+			const auto &prev = r[group[i - 1]];
+			std::uint64_t end = prev.offset + boost::asio::buffer_size(prev.buffer);
+			max_gap = std::max(max_gap, r[group[i]].offset - end);
+		}
+		std::vector<char> scratch(max_gap);
+
+		std::vector<iovec> buffers;
+		std::uint64_t end = r[group.front()].offset;
+		for (auto i : group) {
+			iovec iov;
+			if (r[i].offset > end) {
+				iov.iov_base = scratch.data();
+				iov.iov_len = r[i].offset - end;
+				buffers.push_back(iov);
+			}
+			iov.iov_base = boost::asio::buffer_cast<void *>(r[i].buffer);
+			iov.iov_len = boost::asio::buffer_size(r[i].buffer);
+			buffers.push_back(iov);
+			end = r[i].offset + iov.iov_len;
+		}
+		std::uint64_t offset = r[group.front()].offset;
+		auto ret = preadv(this->impl.fh, &buffers[0], buffers.size(), offset);
+		if (ret == -1) {
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			ret = 0;
+		}
+		std::uint64_t read_end = offset + ret;
+		for (auto i : group) {
+			std::uint64_t size = boost::asio::buffer_size(r[i].buffer);
+			if (read_end <= r[i].offset)
+				r[i].bytes_transferred = 0;
+			else
+				r[i].bytes_transferred = std::min(size, read_end - r[i].offset);
+		}
+	}
+	ImplementationType &impl;
+	std::shared_ptr<std::vector<read_range>> ranges;
+	std::vector<std::size_t> group;
+};
+
+struct extent {
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+ /* finds data extents of a file with SEEK_DATA and SEEK_HOLE.  lseek moves
+  * the offset of the open file description, which async_write, async_read
+  * and async_seek use, so it seeks on a private descriptor reopened through
+  * /proc/self/fd.  If that cannot be opened (no /proc, or a file opened
+  * write only), or the filesystem has no SEEK_DATA, everything counts as
+  * data.
+  */
+class data_finder {
+public:
+	explicit data_finder(int fh)
+	{
+		std::string proc = "/proc/self/fd/" + std::to_string(fh);
+		private_fh = ::open(proc.c_str(), O_RDONLY | O_CLOEXEC);
+	}
+	data_finder(const data_finder &) = delete;
+	data_finder &operator=(const data_finder &) = delete;
+	~data_finder()
+	{
+		if (private_fh != -1)
+			::close(private_fh);
+	}
+	 /* the first data extent in [offset, end); data_begin == data_end == end
+	  * if there is none.
+	  */
+	void find(
+		std::uint64_t offset,
+		std::uint64_t end,
+		std::uint64_t &data_begin,
+		std::uint64_t &data_end,
+		boost::system::error_code &ec)
+	{
+		data_begin = offset;
+		data_end = end;
+		if (private_fh == -1)
+			return;
+		auto ret = ::lseek(private_fh, offset, SEEK_DATA);
+		if (ret == -1) {
+			if (errno == ENXIO)
+				data_begin = end;
+			else if (errno != EINVAL)
+				ec = boost::system::error_code(errno, boost::system::system_category());
+			return;
+		}
+		data_begin = std::min<std::uint64_t>(ret, end);
+		ret = ::lseek(private_fh, ret, SEEK_HOLE);
+		if (ret != -1)
+			data_end = std::min<std::uint64_t>(ret, end);
+	}
+
+private:
+	int private_fh;
+};
+
+template <typename ImplementationType>
+struct copy_range_op {
+	typedef std::tuple<boost::system::error_code, std::uint64_t> parameter_type;
+	typedef std::function<void (std::uint64_t)> progress_type;
+	copy_range_op(
+		ImplementationType &src,
+		std::uint64_t src_offset,
+		ImplementationType &dst,
+		std::uint64_t dst_offset,
+		std::uint64_t size,
+		progress_type progress) :
+		src(src),
+		src_offset(src_offset),
+		dst(dst),
+		dst_offset(dst_offset),
+		size(size),
+		progress(progress)
+	{
+	}
+	void operator()(boost::system::error_code &ec, std::uint64_t &bytes_copied)
+	{
+		bytes_copied = 0;
+		if (size == 0)
+			return;
+		if (clone(ec)) {
+			bytes_copied = size;
+			return;
+		}
+		if (ec)
+			return;
+
+		 /* copy only the data extents of src, holes are punched into dst */
+		struct stat st;
+		if (::fstat(src.fh, &st) != 0) {
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			return;
+		}
+		std::uint64_t src_size = st.st_size;
+		std::uint64_t end = src_size > src_offset ? std::min(size, src_size - src_offset) : 0;
+		data_finder finder(src.fh);
+		while (bytes_copied < end) {
+			std::uint64_t data_begin, data_end;
+			finder.find(src_offset + bytes_copied, src_offset + end, data_begin, data_end, ec);
+			if (ec)
+				return;
+			data_begin -= src_offset;
+			data_end -= src_offset;
+			if (data_begin > bytes_copied) {
+				zero(bytes_copied, data_begin, ec);
+				if (ec)
+					return;
+				bytes_copied = data_begin;
+				report(bytes_copied);
+			}
+			if (data_end > bytes_copied && !copy_data(data_end, ec, bytes_copied))
+				return;
+		}
+	}
+	 /* reflink the whole range; only works when the filesystem supports it
+	  * and the range is block aligned.
+	  */
+	bool clone(boost::system::error_code &ec)
+	{
+#ifdef FICLONERANGE
+		file_clone_range arg;
+		arg.src_fd = src.fh;
+		arg.src_offset = src_offset;
+		arg.src_length = size;
+		arg.dest_offset = dst_offset;
+		if (::ioctl(dst.fh, FICLONERANGE, &arg) == 0)
+			return true;
+		if (!fallback_errno(errno))
+			ec = boost::system::error_code(errno, boost::system::system_category());
+#else
+		(void)ec;
+#endif
+		return false;
+	}
+	 /* copies up to the relative position until, returns false if src ended
+	  * early or on error.
+	  */
+	bool copy_data(std::uint64_t until, boost::system::error_code &ec, std::uint64_t &bytes_copied)
+	{
+		if (use_copy_file_range && copy_file_range(until, ec, bytes_copied))
+			return !ec && bytes_copied == until;
+		return copy_user_space(until, ec, bytes_copied);
+	}
+	 /* returns false if the kernel cannot copy between these two files
+	  * before anything was copied.
+	  */
+	bool copy_file_range(std::uint64_t until, boost::system::error_code &ec, std::uint64_t &bytes_copied)
+	{
+		const std::uint64_t chunk_size = 16 << 20;
+		loff_t in = src_offset + bytes_copied;
+		loff_t out = dst_offset + bytes_copied;
+		bool first = true;
+		while (bytes_copied < until) {
+			std::size_t chunk = std::min<std::uint64_t>(until - bytes_copied, chunk_size);
+			auto ret = ::copy_file_range(src.fh, &in, dst.fh, &out, chunk, 0);
+			if (ret == -1) {
+				if (errno == EINTR)
+					continue;
+				if (first && fallback_errno(errno)) {
+					use_copy_file_range = false;
+					return false;
+				}
+				ec = boost::system::error_code(errno, boost::system::system_category());
+				break;
+			}
+			if (ret == 0)
+				break;
+			first = false;
+			bytes_copied += ret;
+			report(bytes_copied);
+		}
+		return true;
+	}
+	bool copy_user_space(std::uint64_t until, boost::system::error_code &ec, std::uint64_t &bytes_copied)
+	{
+		if (buffer.empty())
+			buffer.resize(std::min<std::uint64_t>(size, 1 << 20));
+		while (bytes_copied < until) {
+			std::size_t chunk = std::min<std::uint64_t>(until - bytes_copied, buffer.size());
+			auto ret = ::pread(src.fh, buffer.data(), chunk, src_offset + bytes_copied);
+			if (ret == -1) {
+				if (errno == EINTR)
+					continue;
+				ec = boost::system::error_code(errno, boost::system::system_category());
+				return false;
+			}
+			if (ret == 0)
+				return false;
+			std::size_t n = ret;
+			if (!write_user_space(buffer.data(), n, ec, bytes_copied))
+				return false;
+			report(bytes_copied);
+		}
+		return true;
+	}
+	bool write_user_space(const char *data, std::size_t n, boost::system::error_code &ec, std::uint64_t &bytes_copied)
+	{
+		for (std::size_t done = 0; done < n; ) {
+			auto w = ::pwrite(dst.fh, data + done, n - done, dst_offset + bytes_copied + done);
+			if (w == -1) {
+				if (errno == EINTR)
+					continue;
+				ec = boost::system::error_code(errno, boost::system::system_category());
+				bytes_copied += done;
+				return false;
+			}
+			done += w;
+		}
+		bytes_copied += n;
+		return true;
+	}
+	 /* makes [from, to) of the copy read as zeros in dst, keeping it sparse
+	  * where the filesystem allows.
+	  */
+	void zero(std::uint64_t from, std::uint64_t to, boost::system::error_code &ec)
+	{
+		if (::fallocate(dst.fh, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, dst_offset + from, to - from) != 0) {
+			if (errno != EOPNOTSUPP) {
+				ec = boost::system::error_code(errno, boost::system::system_category());
+				return;
+			}
+			std::vector<char> zeros(std::min<std::uint64_t>(to - from, 1 << 20));
+			while (from < to) {
+				std::size_t n = std::min<std::uint64_t>(to - from, zeros.size());
+				if (!write_user_space(zeros.data(), n, ec, from))
+					return;
+			}
+			return;
+		}
+		struct stat st;
+		if (::fstat(dst.fh, &st) != 0) {
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			return;
+		}
+		if (std::uint64_t(st.st_size) < dst_offset + to &&
+		    ::ftruncate(dst.fh, dst_offset + to) != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	static bool fallback_errno(int e)
+	{
+		return
+			e == EINVAL ||
+			e == EOPNOTSUPP ||
+			e == ENOTTY ||
+			e == EXDEV ||
+			e == ENOSYS ||
+			e == EBADF;
+	}
+	void report(std::uint64_t bytes_copied)
+	{
+		if (progress)
+			progress(bytes_copied);
+	}
+	ImplementationType &src;
+	std::uint64_t src_offset;
+	ImplementationType &dst;
+	std::uint64_t dst_offset;
+	std::uint64_t size;
+	progress_type progress;
+	bool use_copy_file_range = true;
+	std::vector<char> buffer;
+};
+
+template <typename ImplementationType>
+struct fallocate_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	fallocate_op(
+		ImplementationType &impl,
+		int mode,
+		std::uint64_t offset,
+		std::uint64_t size) :
+		impl(impl),
+		mode(mode),
+		offset(offset),
+		size(size)
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		int ret = ::fallocate(this->impl.fh, mode, offset, size);
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	ImplementationType &impl;
+	int mode;
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+ /* the data extents in [offset, offset + size), clipped to that range */
+template <typename ImplementationType>
+struct extents_op {
+	typedef std::tuple<boost::system::error_code, std::vector<extent>> parameter_type;
+	extents_op(
+		ImplementationType &impl,
+		std::uint64_t offset,
+		std::uint64_t size) :
+		impl(impl),
+		offset(offset),
+		size(size)
+	{
+	}
+	void operator()(boost::system::error_code &ec, std::vector<extent> &extents)
+	{
+		struct stat st;
+		if (::fstat(this->impl.fh, &st) != 0) {
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			return;
+		}
+		std::uint64_t file_size = st.st_size;
+		if (offset >= file_size)
+			return;
+		 /* size may be anything up to UINT64_MAX, for "to the end" */
+		std::uint64_t end = size > file_size - offset ? file_size : offset + size;
+		data_finder finder(this->impl.fh);
+		for (std::uint64_t pos = offset; pos < end; ) {
+			std::uint64_t data_begin, data_end;
+			finder.find(pos, end, data_begin, data_end, ec);
+			if (ec)
+				return;
+			if (data_begin < data_end)
+				extents.push_back(extent{data_begin, data_end - data_begin});
+			pos = data_end;
+		}
+	}
+	ImplementationType &impl;
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+ /* like read_at_op, but only reads the data extents and fills holes with
+  * zeros; reads up to the end of the buffers or of the file.
+  */
+template <typename ImplementationType, typename MutableBufferSequence>
+struct read_sparse_at_op {
+	typedef std::tuple<boost::system::error_code, std::size_t> parameter_type;
+	read_sparse_at_op(
+		ImplementationType &impl,
+		std::uint64_t offset,
+		MutableBufferSequence buffer) :
+		impl(impl),
+		offset(offset),
+		buffer(buffer)
+	{
+	}
+	void operator()(boost::system::error_code &ec, std::size_t &bytes_transferred)
+	{
+		bytes_transferred = 0;
+		struct stat st;
+		if (::fstat(this->impl.fh, &st) != 0) {
+			ec = boost::system::error_code(errno, boost::system::system_category());
+			return;
+		}
+		std::uint64_t end = std::min<std::uint64_t>(
+			offset + boost::asio::buffer_size(buffer),
+			std::max<std::uint64_t>(st.st_size, offset));
+		data_finder finder(this->impl.fh);
+		for (std::uint64_t pos = offset; pos < end; ) {
+			std::uint64_t data_begin, data_end;
+			finder.find(pos, end, data_begin, data_end, ec);
+			if (ec)
+				return;
+			fill_zero(pos - offset, data_begin - pos);
+			bytes_transferred = data_begin - offset;
+			pos = data_begin;
+			while (pos < data_end) {
+				auto buffers = iovecs(pos - offset, data_end - pos);
+				auto ret = preadv(this->impl.fh, &buffers[0], buffers.size(), pos);
+				if (ret == -1) {
+					if (errno == EINTR)
+						continue;
+					ec = boost::system::error_code(errno, boost::system::system_category());
+					return;
+				}
+				if (ret == 0)
+					return;
+				pos += ret;
+				bytes_transferred = pos - offset;
+			}
+		}
+	}
+	 /* the part [from, from + size) of the buffers */
+	std::vector<iovec> iovecs(std::uint64_t from, std::uint64_t size)
+	{
+		std::vector<iovec> buffers;
+		for (const auto &e : buffer) {
+			std::size_t len = boost::asio::buffer_size(e);
+			if (from >= len) {
+				from -= len;
+				continue;
+			}
+			if (size == 0 || buffers.size() == IOV_MAX)
+				break;
+			iovec iov;
+			iov.iov_base = boost::asio::buffer_cast<char *>(e) + from;
+			iov.iov_len = std::min<std::uint64_t>(len - from, size);
+			buffers.push_back(iov);
+			size -= iov.iov_len;
+			from = 0;
+		}
+		return buffers;
+	}
+	void fill_zero(std::uint64_t from, std::uint64_t size)
+	{
+		for (const auto &iov : iovecs(from, size))
+			std::memset(iov.iov_base, 0, iov.iov_len);
+	}
+	ImplementationType &impl;
+	std::uint64_t offset;
+	MutableBufferSequence buffer;
+};
+
+template <typename ImplementationType>
+struct fstat_op {
+	typedef std::tuple<boost::system::error_code, struct stat> parameter_type;
+	fstat_op(
+		ImplementationType &impl) :
+		impl(impl)
+	{
+	}
+	void operator()(boost::system::error_code &ec, struct stat &st)
+	{
+		int ret = ::fstat(this->impl.fh, &st);
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	ImplementationType &impl;
+};
+
+struct stat_op {
+	typedef std::tuple<boost::system::error_code, struct stat> parameter_type;
+	stat_op(
+		const boost::filesystem::path &path) :
+		path(path)
+	{
+	}
+	void operator()(boost::system::error_code &ec, struct stat &st)
+	{
+		int ret = ::stat(path.native().c_str(), &st);
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	boost::filesystem::path path;
+};
+
+#ifdef STATX_BASIC_STATS
+struct statx_op {
+	typedef std::tuple<boost::system::error_code, struct statx> parameter_type;
+	statx_op(
+		const boost::filesystem::path &path,
+		int flags,
+		unsigned mask) :
+		path(path),
+		flags(flags),
+		mask(mask)
+	{
+	}
+	void operator()(boost::system::error_code &ec, struct statx &st)
+	{
+		int ret = ::statx(AT_FDCWD, path.native().c_str(), flags, mask, &st);
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	boost::filesystem::path path;
+	int flags;
+	unsigned mask;
+};
+#endif
+
+struct rename_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	rename_op(
+		const boost::filesystem::path &from,
+		const boost::filesystem::path &to) :
+		from(from),
+		to(to)
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		int ret = ::rename(from.native().c_str(), to.native().c_str());
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	boost::filesystem::path from;
+	boost::filesystem::path to;
+};
+
+struct unlink_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	unlink_op(
+		const boost::filesystem::path &path) :
+		path(path)
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		int ret = ::unlink(path.native().c_str());
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	boost::filesystem::path path;
+};
+
+struct mkdir_op {
+	typedef std::tuple<boost::system::error_code> parameter_type;
+	mkdir_op(
+		const boost::filesystem::path &path,
+		mode_t mode) :
+		path(path),
+		mode(mode)
+	{
+	}
+	void operator()(boost::system::error_code &ec)
+	{
+		int ret = ::mkdir(path.native().c_str(), mode);
+		if (ret != 0)
+			ec = boost::system::error_code(errno, boost::system::system_category());
+	}
+	boost::filesystem::path path;
+	mode_t mode;
+};
+
+struct directory_entry {
+	std::uint64_t ino;
+	unsigned char type;
+	std::string name;
+};
+
+ /* returns the next batch of entries, as many as fit into buffer_size bytes
+  * of getdents64 records, "." and ".." left out.  An empty batch means the
+  * end of the directory.
+  */
+template <typename ImplementationType>
+struct read_directory_op {
+	typedef std::tuple<
+		boost::system::error_code,
+		std::vector<directory_entry>
+		> parameter_type;
+	read_directory_op(
+		ImplementationType &impl,
+		std::size_t buffer_size) :
+		impl(impl),
+		buffer_size(buffer_size)
+	{
+	}
+	void operator()(
+		boost::system::error_code &ec,
+		std::vector<directory_entry> &entries)
+	{
+		struct linux_dirent64 {
+			std::uint64_t d_ino;
+			std::int64_t d_off;
+			unsigned short d_reclen;
+			unsigned char d_type;
+			char d_name[1];
+		};
+		std::vector<char> buffer(buffer_size);
+		 /* loop until there is at least one entry besides "." and ".." */
+		while (entries.empty()) {
+			auto ret = ::syscall(SYS_getdents64, this->impl.fh, buffer.data(), buffer.size());
+			if (ret == -1) {
+				if (errno == EINTR)
+					continue;
+				ec = boost::system::error_code(errno, boost::system::system_category());
+				return;
+			}
+			if (ret == 0)
+				return;
+			for (long pos = 0; pos < ret; ) {
+				auto d = reinterpret_cast<const linux_dirent64 *>(buffer.data() + pos);
+				pos += d->d_reclen;
+				if (d->d_name[0] == '.' && (d->d_name[1] == 0 ||
+				    (d->d_name[1] == '.' && d->d_name[2] == 0)))
+					continue;
+				entries.push_back(directory_entry{d->d_ino, d->d_type, d->d_name});
+			}
+		}
+	}
+	ImplementationType &impl;
+	std::size_t buffer_size;
+};
+
 template <typename ImplementationType>
 struct seek_op {
 	typedef std::tuple<boost::system::error_code> parameter_type;
@@ -216,6 +1058,100 @@ struct seek_op {
 };
 
 
+template <typename ImplementationType>
+trace::op_info trace_info(const open_op<ImplementationType> &)
+{
+	return trace::op_info{"open", -1, 0, 0};
+}
+
+template <typename ImplementationType>
+trace::op_info trace_info(const close_op<ImplementationType> &op)
+{
+	return trace::op_info{"close", op.impl.fh, 0, 0};
+}
+
+template <typename ImplementationType>
+trace::op_info trace_info(const fdatasync_op<ImplementationType> &op)
+{
+	return trace::op_info{"fdatasync", op.impl.fh, 0, 0};
+}
+
+template <typename ImplementationType, typename ConstBufferSequence>
+trace::op_info trace_info(const write_at_op<ImplementationType, ConstBufferSequence> &op)
+{
+	return trace::op_info{"pwritev", op.impl.fh, op.offset, boost::asio::buffer_size(op.buffer)};
+}
+
+template <typename ImplementationType, typename ConstBufferSequence>
+trace::op_info trace_info(const write_op<ImplementationType, ConstBufferSequence> &op)
+{
+	return trace::op_info{"writev", op.impl.fh, 0, boost::asio::buffer_size(op.buffer)};
+}
+
+template <typename ImplementationType, typename MutableBufferSequence>
+trace::op_info trace_info(const read_at_op<ImplementationType, MutableBufferSequence> &op)
+{
+	return trace::op_info{"preadv", op.impl.fh, op.offset, boost::asio::buffer_size(op.buffer)};
+}
+
+template <typename ImplementationType, typename MutableBufferSequence>
+trace::op_info trace_info(const read_op<ImplementationType, MutableBufferSequence> &op)
+{
+	return trace::op_info{"readv", op.impl.fh, 0, boost::asio::buffer_size(op.buffer)};
+}
+
+template <typename ImplementationType, typename ConstBufferSequence>
+trace::op_info trace_info(const write_at_checksum_op<ImplementationType, ConstBufferSequence> &op)
+{
+	trace::op_info info = trace_info(op.write);
+	info.name = "pwritev+crc32c";
+	return info;
+}
+
+template <typename ImplementationType, typename MutableBufferSequence>
+trace::op_info trace_info(const read_at_verify_op<ImplementationType, MutableBufferSequence> &op)
+{
+	trace::op_info info = trace_info(op.read);
+	info.name = "preadv+crc32c";
+	return info;
+}
+
+template <typename ImplementationType>
+trace::op_info trace_info(const read_ranges_op<ImplementationType> &op)
+{
+	const auto &first = (*op.ranges)[op.group.front()];
+	const auto &last = (*op.ranges)[op.group.back()];
+	return trace::op_info{
+		"preadv ranges",
+		op.impl.fh,
+		first.offset,
+		last.offset + boost::asio::buffer_size(last.buffer) - first.offset};
+}
+
+template <typename ImplementationType>
+trace::op_info trace_info(const copy_range_op<ImplementationType> &op)
+{
+	return trace::op_info{"copy_range", op.dst.fh, op.dst_offset, op.size};
+}
+
+template <typename ImplementationType>
+trace::op_info trace_info(const fallocate_op<ImplementationType> &op)
+{
+	return trace::op_info{"fallocate", op.impl.fh, op.offset, op.size};
+}
+
+template <typename ImplementationType, typename MutableBufferSequence>
+trace::op_info trace_info(const read_sparse_at_op<ImplementationType, MutableBufferSequence> &op)
+{
+	return trace::op_info{"preadv sparse", op.impl.fh, op.offset, boost::asio::buffer_size(op.buffer)};
+}
+
+template <typename ImplementationType>
+trace::op_info trace_info(const read_directory_op<ImplementationType> &op)
+{
+	return trace::op_info{"getdents64", op.impl.fh, 0, op.buffer_size};
+}
+
 }
 }
 }
@@ -0,0 +1,88 @@
+ /* ----- <push/asio/filesystem.hpp> --------------------------------------- */
+#ifndef push_asio_filesystem_hpp_INCLUDED
+#define push_asio_filesystem_hpp_INCLUDED
+
+#include <push/asio/file_service.hpp>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* path based metadata operations, run on the background_service pool like
+  * the file operations, so a slow filesystem does not block the io_service.
+  */
+
+namespace push {
+namespace asio {
+
+ /* handler: void (boost::system::error_code, struct stat) */
+template <typename StatHandler>
+void async_stat(
+	boost::asio::io_service &io_service,
+	const boost::filesystem::path &path,
+	StatHandler handler)
+{
+	boost::asio::use_service<file_service>(io_service).async_stat(
+		path,
+		handler);
+}
+
+#ifdef STATX_BASIC_STATS
+ /* handler: void (boost::system::error_code, struct statx) */
+template <typename StatHandler>
+void async_statx(
+	boost::asio::io_service &io_service,
+	const boost::filesystem::path &path,
+	int flags,
+	unsigned mask,
+	StatHandler handler)
+{
+	boost::asio::use_service<file_service>(io_service).async_statx(
+		path,
+		flags,
+		mask,
+		handler);
+}
+#endif
+
+ /* handler: void (boost::system::error_code) */
+template <typename RenameHandler>
+void async_rename(
+	boost::asio::io_service &io_service,
+	const boost::filesystem::path &from,
+	const boost::filesystem::path &to,
+	RenameHandler handler)
+{
+	boost::asio::use_service<file_service>(io_service).async_rename(
+		from,
+		to,
+		handler);
+}
+
+ /* handler: void (boost::system::error_code) */
+template <typename UnlinkHandler>
+void async_unlink(
+	boost::asio::io_service &io_service,
+	const boost::filesystem::path &path,
+	UnlinkHandler handler)
+{
+	boost::asio::use_service<file_service>(io_service).async_unlink(
+		path,
+		handler);
+}
+
+ /* handler: void (boost::system::error_code) */
+template <typename MkdirHandler>
+void async_mkdir(
+	boost::asio::io_service &io_service,
+	const boost::filesystem::path &path,
+	mode_t mode,
+	MkdirHandler handler)
+{
+	boost::asio::use_service<file_service>(io_service).async_mkdir(
+		path,
+		mode,
+		handler);
+}
+
+}
+}
+
+#endif
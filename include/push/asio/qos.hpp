@@ -0,0 +1,137 @@
+ /* ----- <push/asio/qos.hpp> ---------------------------------------------- */
+#ifndef push_asio_qos_hpp_INCLUDED
+#define push_asio_qos_hpp_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* a qos_group limits the bytes and operations per second of the files
+  * attached to it (file::set_qos_group), e.g. one group per tenant or one
+  * per file.
+  * 
+  * Both limits are token buckets holding up to one second worth of their
+  * rate, so a group that was idle can burst.  An operation is dispatched
+  * as long as neither bucket is in debt and then takes its tokens, so an
+  * operation larger than the bucket still gets through, it just delays the
+  * following ones.  Operations over budget wait in the group, in order,
+  * not on a worker thread; a timer on the background_service releases them
+  * as the buckets refill.
+  * 
+  * A limit of 0 means unlimited.
+  */
+
+namespace push {
+namespace asio {
+
+class qos_group {
+public:
+	struct usage {
+		 /* dispatched so far */
+		std::uint64_t bytes;
+		std::uint64_t ops;
+		 /* operations that had to wait for tokens */
+		std::uint64_t deferred_ops;
+		 /* operations waiting right now */
+		std::size_t queued_ops;
+	};
+
+	explicit qos_group(
+		std::string name,
+		std::uint64_t bytes_per_second = 0,
+		std::uint64_t ops_per_second = 0);
+
+	const std::string &name() const
+	{
+		return name_;
+	}
+	 /* takes effect for the operations already waiting, too: those the
+	  * new limits admit are dispatched right away.
+	  */
+	void set_limits(
+		std::uint64_t bytes_per_second,
+		std::uint64_t ops_per_second);
+	usage get_usage() const;
+
+private:
+	friend class background_service;
+
+	typedef std::chrono::steady_clock clock;
+
+	struct bucket {
+		double rate;
+		double tokens;
+		void refill(double seconds);
+		bool in_debt() const
+		{
+			return rate != 0 && tokens < 0;
+		}
+		double seconds_until_paid() const;
+	};
+	 /* (re)arms the timer of a background_service to call release() after
+	  * the given time; called with the group locked.
+	  */
+	typedef std::function<void (clock::duration)> wake_function;
+	struct pending {
+		 /* the background_service that submitted op */
+		const void *owner;
+		std::uint64_t bytes;
+		std::function<void ()> op;
+	};
+	struct waker {
+		const void *owner;
+		wake_function wake;
+	};
+
+	 /* op only dispatches the operation (posts it or queues it on a
+	  * serial_queue), and is called with the group locked, so ops are
+	  * dispatched in the order they were submitted.
+	  * 
+	  * Calls op and returns true if it is admitted now; otherwise it is
+	  * queued, and the owner's wake is kept until the queue runs empty,
+	  * to be told about changes of the wait (see set_limits).
+	  */
+	bool submit(
+		const void *owner,
+		std::uint64_t bytes,
+		std::function<void ()> &op,
+		const wake_function &wake);
+	 /* calls the queued ops that are admitted now; wait is zero if the
+	  * queue is empty, otherwise when to try again.
+	  */
+	void release(
+		clock::duration &wait);
+	 /* removes what owner queued, without running it, and forgets its
+	  * wake; for a background_service that shuts down.
+	  */
+	void drop(
+		const void *owner);
+	void dispatch_admitted();
+	void refill();
+	bool admit(std::uint64_t bytes);
+	clock::duration next_wait() const;
+
+	std::string name_;
+	mutable std::mutex mutex;
+	bucket byte_bucket;
+	bucket op_bucket;
+	clock::time_point last_refill;
+	std::deque<pending> queue;
+	 /* one per owner with ops in the queue */
+	std::vector<waker> wakers;
+
+	std::atomic<std::uint64_t> bytes;
+	std::atomic<std::uint64_t> ops;
+	std::atomic<std::uint64_t> deferred_ops;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,111 @@
+ /* ----- <push/asio/trace.hpp> -------------------------------------------- */
+#ifndef push_asio_trace_hpp_INCLUDED
+#define push_asio_trace_hpp_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* opt-in lifecycle tracing of background operations, to find out where an
+  * individual slow operation spent its time:
+  * 
+  * 	submit         the op was handed to the background_service
+  * 	nowait_begin   the calling thread tried it with RWF_NOWAIT; if that
+  * 	nowait_end     did not complete it, the op goes on with dequeue
+  * 	dequeue        a worker picked it up
+  * 	syscall_begin  the worker ran the operation
+  * 	syscall_end
+  * 	handler_begin  the io_service invoked the completion handler
+  * 	handler_end
+  * 
+  * Events go to a fixed size ring buffer per thread, so recording takes no
+  * locks; old events are overwritten.  While tracing is disabled the cost
+  * is one relaxed atomic load per event.
+  * 
+  * dump_chrome_trace() writes everything recorded as Chrome trace event
+  * JSON, which chrome://tracing and https://ui.perfetto.dev load directly.
+  * It can run while operations are traced: each slot carries a sequence
+  * stamp, and events that are being written or were overwritten during
+  * the dump are skipped.
+  */
+
+namespace push {
+namespace asio {
+namespace trace {
+
+enum class event_type : unsigned char {
+	submit,
+	nowait_begin,
+	nowait_end,
+	dequeue,
+	syscall_begin,
+	syscall_end,
+	handler_begin,
+	handler_end
+};
+
+ /* what an operation works on, recorded with its submit event */
+struct op_info {
+	const char *name;
+	int fd;
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+ /* the fallback for operations that do not describe themselves; ops
+  * provide a more specialized trace_info() found by argument dependent
+  * lookup.
+  */
+template <typename Operation>
+op_info trace_info(const Operation &)
+{
+	return op_info{"background", -1, 0, 0};
+}
+
+namespace detail {
+
+extern std::atomic<bool> enabled;
+
+std::uint64_t next_id();
+
+void record(
+	std::uint64_t id,
+	event_type type,
+	const op_info *info);
+
+}
+
+void enable(bool on = true);
+
+inline bool enabled()
+{
+	return detail::enabled.load(std::memory_order_relaxed);
+}
+
+ /* drops all recorded events */
+void clear();
+
+void dump_chrome_trace(std::ostream &os);
+
+ /* returns the id for a new operation, 0 (not traced) while disabled */
+inline std::uint64_t submit(const op_info &info)
+{
+	if (!enabled())
+		return 0;
+	std::uint64_t id = detail::next_id();
+	detail::record(id, event_type::submit, &info);
+	return id;
+}
+
+inline void record(std::uint64_t id, event_type type)
+{
+	if (id != 0)
+		detail::record(id, type, nullptr);
+}
+
+}
+}
+}
+
+#endif
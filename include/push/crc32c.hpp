@@ -0,0 +1,32 @@
+ /* ----- <push/crc32c.hpp> ------------------------------------------------ */
+#ifndef push_crc32c_hpp_INCLUDED
+#define push_crc32c_hpp_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* CRC32C (Castagnoli), as used by iSCSI, ext4 and most storage formats.
+  * 
+  * crc32c() follows the zlib crc32() convention: start with 0 and feed the
+  * previous result back in to checksum data piecewise.  The SSE4.2 crc32
+  * instruction is used when the cpu has it (checked on the first call), a
+  * slicing-by-8 table implementation otherwise.
+  */
+
+namespace push {
+
+std::uint32_t crc32c(
+	std::uint32_t crc,
+	const void *data,
+	std::size_t size);
+
+ /* the crc of the concatenation A + B, given crc(A), crc(B) and size(B) */
+std::uint32_t crc32c_combine(
+	std::uint32_t crc1,
+	std::uint32_t crc2,
+	std::uint64_t size2);
+
+}
+
+#endif
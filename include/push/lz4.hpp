@@ -0,0 +1,44 @@
+ /* ----- <push/lz4.hpp> --------------------------------------------------- */
+#ifndef push_lz4_hpp_INCLUDED
+#define push_lz4_hpp_INCLUDED
+
+#include <cstddef>
+
+ /* ----- idea ------------------------------------------------------------- */
+ /* a small, self contained codec producing the LZ4 block format (see
+  * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), so data
+  * written by it can be read by any other LZ4 implementation and vice versa.
+  * 
+  * Only the fast greedy compressor is implemented; there is no frame format,
+  * callers keep track of the compressed and uncompressed sizes themselves.
+  */
+
+namespace push {
+
+ /* the worst case size of lz4_compress() output for size bytes of input */
+inline std::size_t lz4_compress_bound(std::size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+ /* returns the compressed size, or 0 if the output did not fit into
+  * capacity bytes.
+  */
+std::size_t lz4_compress(
+	const void *src,
+	std::size_t size,
+	void *dst,
+	std::size_t capacity);
+
+ /* returns the decompressed size, or std::size_t(-1) if src is not a valid
+  * LZ4 block or does not decompress into capacity bytes.
+  */
+std::size_t lz4_decompress(
+	const void *src,
+	std::size_t size,
+	void *dst,
+	std::size_t capacity);
+
+}
+
+#endif
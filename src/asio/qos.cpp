@@ -0,0 +1,175 @@
+#include <push/asio/qos.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+namespace push {
+namespace asio {
+
+void qos_group::bucket::refill(double seconds)
+{
+	if (rate == 0)
+		return;
+	tokens = std::min(rate, tokens + rate * seconds);
+}
+
+double qos_group::bucket::seconds_until_paid() const
+{
+	if (!in_debt())
+		return 0;
+	return -tokens / rate;
+}
+
+qos_group::qos_group(
+	std::string name,
+	std::uint64_t bytes_per_second,
+	std::uint64_t ops_per_second) :
+	name_(std::move(name)),
+	last_refill(clock::now()),
+	bytes(0),
+	ops(0),
+	deferred_ops(0)
+{
+	byte_bucket.rate = byte_bucket.tokens = double(bytes_per_second);
+	op_bucket.rate = op_bucket.tokens = double(ops_per_second);
+}
+
+void qos_group::set_limits(
+	std::uint64_t bytes_per_second,
+	std::uint64_t ops_per_second)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	refill();
+	byte_bucket.rate = double(bytes_per_second);
+	byte_bucket.tokens = std::min(byte_bucket.tokens, byte_bucket.rate);
+	op_bucket.rate = double(ops_per_second);
+	op_bucket.tokens = std::min(op_bucket.tokens, op_bucket.rate);
+	dispatch_admitted();
+	if (queue.empty()) {
+		wakers.clear();
+		return;
+	}
+	 /* the wait may be shorter now than what the timers were armed for */
+	auto wait = next_wait();
+	for (auto &w : wakers)
+		w.wake(wait);
+}
+
+qos_group::usage qos_group::get_usage() const
+{
+	usage u;
+	u.bytes = bytes.load(std::memory_order_relaxed);
+	u.ops = ops.load(std::memory_order_relaxed);
+	u.deferred_ops = deferred_ops.load(std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		u.queued_ops = queue.size();
+	}
+	return u;
+}
+
+bool qos_group::submit(
+	const void *owner,
+	std::uint64_t bytes,
+	std::function<void ()> &op,
+	const wake_function &wake)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	refill();
+	 /* nobody overtakes the ops already waiting */
+	if (queue.empty() && admit(bytes)) {
+		op();
+		return true;
+	}
+	queue.push_back(pending{owner, bytes, std::move(op)});
+	++deferred_ops;
+	auto w = std::find_if(
+		wakers.begin(),
+		wakers.end(),
+		[owner](const waker &w) { return w.owner == owner; });
+	if (w == wakers.end()) {
+		wakers.push_back(waker{owner, wake});
+		wake(next_wait());
+	}
+	return false;
+}
+
+void qos_group::release(
+	clock::duration &wait)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	refill();
+	dispatch_admitted();
+	if (queue.empty()) {
+		wakers.clear();
+		wait = clock::duration::zero();
+	} else {
+		wait = next_wait();
+	}
+}
+
+void qos_group::drop(
+	const void *owner)
+{
+	 /* destroyed after the lock is released */
+	std::deque<pending> dropped;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto keep = std::stable_partition(
+		queue.begin(),
+		queue.end(),
+		[owner](const pending &p) { return p.owner != owner; });
+	std::move(keep, queue.end(), std::back_inserter(dropped));
+	queue.erase(keep, queue.end());
+	wakers.erase(
+		std::remove_if(
+			wakers.begin(),
+			wakers.end(),
+			[owner](const waker &w) { return w.owner == owner; }),
+		wakers.end());
+}
+
+ /* with the group locked */
+void qos_group::dispatch_admitted()
+{
+	while (!queue.empty() && admit(queue.front().bytes)) {
+		queue.front().op();
+		queue.pop_front();
+	}
+}
+
+void qos_group::refill()
+{
+	auto now = clock::now();
+	double seconds = std::chrono::duration<double>(now - last_refill).count();
+	last_refill = now;
+	byte_bucket.refill(seconds);
+	op_bucket.refill(seconds);
+}
+
+bool qos_group::admit(std::uint64_t size)
+{
+	if (byte_bucket.in_debt() || op_bucket.in_debt())
+		return false;
+	if (byte_bucket.rate != 0)
+		byte_bucket.tokens -= double(size);
+	if (op_bucket.rate != 0)
+		op_bucket.tokens -= 1;
+	bytes += size;
+	++ops;
+	return true;
+}
+
+qos_group::clock::duration qos_group::next_wait() const
+{
+	 /* don't spin on tiny debts */
+	double seconds = std::max(
+		1e-4,
+		std::max(
+			byte_bucket.seconds_until_paid(),
+			op_bucket.seconds_until_paid()));
+	return std::chrono::duration_cast<clock::duration>(
+		std::chrono::duration<double>(seconds));
+}
+
+}
+}
@@ -0,0 +1,280 @@
+#include <push/asio/trace.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace push {
+namespace asio {
+namespace trace {
+namespace detail {
+
+std::atomic<bool> enabled(false);
+
+namespace {
+
+const std::size_t ring_size = 1 << 16;
+
+struct event {
+	std::uint64_t id;
+	std::uint64_t timestamp;
+	op_info info;
+	event_type type;
+};
+
+ /* a seqlock per slot: seq is odd while the event is written and
+  * 2 * (position + 1) once the event at that position of the ring is
+  * complete, so a reader can tell torn and overwritten events.
+  */
+struct slot {
+	std::atomic<std::uint64_t> seq;
+	event e;
+	slot() : seq(0) { }
+};
+
+inline std::uint64_t stamp(std::uint64_t position)
+{
+	return 2 * (position + 1);
+}
+
+struct ring {
+	unsigned tid;
+	std::atomic<std::uint64_t> head;
+	std::vector<slot> slots;
+	explicit ring(unsigned tid) : tid(tid), head(0), slots(ring_size) { }
+};
+
+ /* rings outlive their threads, so events of finished threads can still
+  * be dumped.
+  */
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<ring>> registry;
+std::atomic<std::uint64_t> last_id(0);
+
+ring &this_thread_ring()
+{
+	thread_local std::shared_ptr<ring> r;
+	if (!r) {
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		r = std::make_shared<ring>(static_cast<unsigned>(registry.size() + 1));
+		registry.push_back(r);
+	}
+	return *r;
+}
+
+std::uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+std::uint64_t next_id()
+{
+	return ++last_id;
+}
+
+void record(
+	std::uint64_t id,
+	event_type type,
+	const op_info *info)
+{
+	ring &r = this_thread_ring();
+	std::uint64_t h = r.head.load(std::memory_order_relaxed);
+	slot &s = r.slots[h % ring_size];
+	s.seq.store(stamp(h) - 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	event &e = s.e;
+	e.id = id;
+	e.timestamp = now();
+	e.type = type;
+	if (info)
+		e.info = *info;
+	else
+		e.info = op_info{nullptr, -1, 0, 0};
+	s.seq.store(stamp(h), std::memory_order_release);
+	r.head.store(h + 1, std::memory_order_release);
+}
+
+}
+
+void enable(bool on)
+{
+	detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+void clear()
+{
+	std::lock_guard<std::mutex> lock(detail::registry_mutex);
+	for (auto &r : detail::registry)
+		r->head.store(0, std::memory_order_relaxed);
+}
+
+namespace {
+
+const std::size_t event_types = static_cast<std::size_t>(event_type::handler_end) + 1;
+
+struct op_events {
+	op_info info = op_info{nullptr, -1, 0, 0};
+	std::uint64_t t[event_types] = { };
+	unsigned tid[event_types] = { };
+	bool seen[event_types] = { };
+};
+
+void write_json_string(std::ostream &os, const char *s)
+{
+	os << '"';
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			os << '\\';
+		os << *s;
+	}
+	os << '"';
+}
+
+void write_slice(
+	std::ostream &os,
+	bool &first,
+	const char *name,
+	unsigned tid,
+	std::uint64_t id,
+	std::uint64_t begin,
+	std::uint64_t end)
+{
+	os << (first ? "\n" : ",\n");
+	first = false;
+	os << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"name\":";
+	write_json_string(os, name);
+	os << ",\"ts\":" << begin / 1000.0
+	   << ",\"dur\":" << (end - begin) / 1000.0
+	   << ",\"args\":{\"op\":" << id << "}}";
+}
+
+ /* waiting in a queue does not happen on any thread, so those phases are
+  * async slices nested into the op.
+  */
+void write_async(
+	std::ostream &os,
+	bool &first,
+	const char *name,
+	std::uint64_t id,
+	std::uint64_t begin,
+	std::uint64_t end)
+{
+	const char *ph[] = { "b", "e" };
+	std::uint64_t ts[] = { begin, end };
+	for (int i = 0; i < 2; ++i) {
+		os << (first ? "\n" : ",\n");
+		first = false;
+		os << "{\"ph\":\"" << ph[i] << "\",\"cat\":\"op\",\"pid\":1,\"id\":" << id << ",\"name\":";
+		write_json_string(os, name);
+		os << ",\"ts\":" << ts[i] / 1000.0 << "}";
+	}
+}
+
+}
+
+void dump_chrome_trace(std::ostream &os)
+{
+	typedef std::size_t index;
+	std::map<std::uint64_t, op_events> ops;
+	{
+		std::lock_guard<std::mutex> lock(detail::registry_mutex);
+		for (auto &r : detail::registry) {
+			std::uint64_t head = r->head.load(std::memory_order_acquire);
+			std::uint64_t begin = head > detail::ring_size ? head - detail::ring_size : 0;
+			for (std::uint64_t i = begin; i < head; ++i) {
+				const auto &s = r->slots[i % detail::ring_size];
+				if (s.seq.load(std::memory_order_acquire) != detail::stamp(i))
+					continue;
+				const detail::event e = s.e;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (s.seq.load(std::memory_order_relaxed) != detail::stamp(i))
+					continue;
+				auto &o = ops[e.id];
+				index k = static_cast<index>(e.type);
+				o.t[k] = e.timestamp;
+				o.tid[k] = r->tid;
+				o.seen[k] = true;
+				if (e.type == event_type::submit)
+					o.info = e.info;
+			}
+		}
+	}
+
+	const index submit = static_cast<index>(event_type::submit);
+	const index nowait_begin = static_cast<index>(event_type::nowait_begin);
+	const index nowait_end = static_cast<index>(event_type::nowait_end);
+	const index dequeue = static_cast<index>(event_type::dequeue);
+	const index syscall_begin = static_cast<index>(event_type::syscall_begin);
+	const index syscall_end = static_cast<index>(event_type::syscall_end);
+	const index handler_begin = static_cast<index>(event_type::handler_begin);
+	const index handler_end = static_cast<index>(event_type::handler_end);
+
+	 /* timestamps are in microseconds, keep the nanoseconds */
+	auto flags = os.flags();
+	auto precision = os.precision();
+	os << std::fixed << std::setprecision(3);
+
+	bool first = true;
+	os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	for (const auto &p : ops) {
+		const std::uint64_t id = p.first;
+		const op_events &o = p.second;
+		 /* the ring wrapped and the start of this op is gone */
+		if (!o.seen[submit])
+			continue;
+		const char *name = o.info.name ? o.info.name : "op";
+
+		index last = submit;
+		for (index k = submit; k < event_types; ++k)
+			if (o.seen[k] && o.t[k] > o.t[last])
+				last = k;
+		 /* the whole life of the op, as an async slice with its arguments */
+		os << (first ? "\n" : ",\n");
+		first = false;
+		os << "{\"ph\":\"b\",\"cat\":\"op\",\"pid\":1,\"id\":" << id << ",\"name\":";
+		write_json_string(os, name);
+		os << ",\"ts\":" << o.t[submit] / 1000.0
+		   << ",\"args\":{\"fd\":" << o.info.fd
+		   << ",\"offset\":" << o.info.offset
+		   << ",\"size\":" << o.info.size << "}},\n";
+		os << "{\"ph\":\"e\",\"cat\":\"op\",\"pid\":1,\"id\":" << id << ",\"name\":";
+		write_json_string(os, name);
+		os << ",\"ts\":" << o.t[last] / 1000.0 << "}";
+
+		 /* the RWF_NOWAIT attempt on the calling thread; the op only goes
+		  * to a worker if it did not complete.
+		  */
+		const bool nowait = o.seen[nowait_begin] && o.seen[nowait_end];
+		if (nowait)
+			write_slice(os, first, "nowait", o.tid[nowait_begin], id, o.t[nowait_begin], o.t[nowait_end]);
+		if (o.seen[dequeue])
+			write_async(os, first, "queued", id, nowait ? o.t[nowait_end] : o.t[submit], o.t[dequeue]);
+		if (o.seen[syscall_begin] && o.seen[syscall_end])
+			write_slice(os, first, name, o.tid[syscall_begin], id, o.t[syscall_begin], o.t[syscall_end]);
+		 /* the handler runs after the worker, or after a nowait attempt
+		  * that completed the op.
+		  */
+		if (o.seen[handler_begin]) {
+			if (o.seen[syscall_end])
+				write_async(os, first, "completion queued", id, o.t[syscall_end], o.t[handler_begin]);
+			else if (nowait && !o.seen[dequeue])
+				write_async(os, first, "completion queued", id, o.t[nowait_end], o.t[handler_begin]);
+		}
+		if (o.seen[handler_begin] && o.seen[handler_end])
+			write_slice(os, first, "handler", o.tid[handler_begin], id, o.t[handler_begin], o.t[handler_end]);
+	}
+	os << "\n]}\n";
+	os.flags(flags);
+	os.precision(precision);
+}
+
+}
+}
+}
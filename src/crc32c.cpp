@@ -0,0 +1,197 @@
+#include <push/crc32c.hpp>
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace push {
+namespace {
+
+const std::uint32_t poly = 0x82f63b78;
+
+struct tables {
+	std::uint32_t t[8][256];
+	 /* x2n[k] = x^(2^k) mod p */
+	std::uint32_t x2n[32];
+
+	tables()
+	{
+		for (unsigned i = 0; i < 256; ++i) {
+			std::uint32_t c = i;
+			for (unsigned k = 0; k < 8; ++k)
+				c = c & 1 ? (c >> 1) ^ poly : c >> 1;
+			t[0][i] = c;
+		}
+		for (unsigned i = 0; i < 256; ++i)
+			for (unsigned s = 1; s < 8; ++s)
+				t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+		std::uint32_t p = std::uint32_t(1) << 30;
+		x2n[0] = p;
+		for (unsigned n = 1; n < 32; ++n)
+			x2n[n] = p = multmodp(p, p);
+	}
+	 /* a * b mod p, both in reflected representation */
+	static std::uint32_t multmodp(std::uint32_t a, std::uint32_t b)
+	{
+		std::uint32_t m = std::uint32_t(1) << 31;
+		std::uint32_t p = 0;
+		for (;;) {
+			if (a & m) {
+				p ^= b;
+				if ((a & (m - 1)) == 0)
+					break;
+			}
+			m >>= 1;
+			b = b & 1 ? (b >> 1) ^ poly : b >> 1;
+		}
+		return p;
+	}
+	 /* x^(n * 2^k) mod p */
+	std::uint32_t x2nmodp(std::uint64_t n, unsigned k) const
+	{
+		std::uint32_t p = std::uint32_t(1) << 31;
+		while (n) {
+			if (n & 1)
+				p = multmodp(x2n[k & 31], p);
+			n >>= 1;
+			++k;
+		}
+		return p;
+	}
+};
+
+const tables &get_tables()
+{
+	static const tables t;
+	return t;
+}
+
+std::uint32_t crc32c_sw(
+	std::uint32_t crc,
+	const void *data,
+	std::size_t size)
+{
+	const auto &t = get_tables().t;
+	auto p = static_cast<const unsigned char *>(data);
+	std::uint32_t c = ~crc;
+	while (size && (reinterpret_cast<std::uintptr_t>(p) & 7)) {
+		c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+		--size;
+	}
+	while (size >= 8) {
+		std::uint64_t w;
+		std::memcpy(&w, p, 8);
+		w ^= c;
+		c =	t[7][w & 0xff] ^
+			t[6][(w >> 8) & 0xff] ^
+			t[5][(w >> 16) & 0xff] ^
+			t[4][(w >> 24) & 0xff] ^
+			t[3][(w >> 32) & 0xff] ^
+			t[2][(w >> 40) & 0xff] ^
+			t[1][(w >> 48) & 0xff] ^
+			t[0][w >> 56];
+		p += 8;
+		size -= 8;
+	}
+	while (size--)
+		c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+	return ~c;
+}
+
+#if defined(__x86_64__)
+ /* the crc32 instruction has a latency of 3 cycles but a throughput of one
+  * per cycle, so large inputs are checksummed as three interleaved streams
+  * that are merged with crc32c_combine.
+  */
+const std::size_t stream_size = 4096;
+
+__attribute__((target("sse4.2")))
+std::uint32_t crc32c_hw_raw(
+	std::uint32_t c,
+	const unsigned char *p,
+	std::size_t size)
+{
+	while (size && (reinterpret_cast<std::uintptr_t>(p) & 7)) {
+		c = _mm_crc32_u8(c, *p++);
+		--size;
+	}
+	std::uint64_t c64 = c;
+	while (size >= 8) {
+		std::uint64_t w;
+		std::memcpy(&w, p, 8);
+		c64 = _mm_crc32_u64(c64, w);
+		p += 8;
+		size -= 8;
+	}
+	c = std::uint32_t(c64);
+	while (size--)
+		c = _mm_crc32_u8(c, *p++);
+	return c;
+}
+
+__attribute__((target("sse4.2")))
+std::uint32_t crc32c_hw(
+	std::uint32_t crc,
+	const void *data,
+	std::size_t size)
+{
+	static const std::uint32_t shift = get_tables().x2nmodp(stream_size, 3);
+	auto p = static_cast<const unsigned char *>(data);
+	std::uint32_t c = ~crc;
+	while (size >= 3 * stream_size) {
+		std::uint64_t c0 = c;
+		std::uint64_t c1 = 0xffffffff;
+		std::uint64_t c2 = 0xffffffff;
+		for (std::size_t i = 0; i < stream_size; i += 8) {
+			std::uint64_t w0, w1, w2;
+			std::memcpy(&w0, p + i, 8);
+			std::memcpy(&w1, p + stream_size + i, 8);
+			std::memcpy(&w2, p + 2 * stream_size + i, 8);
+			c0 = _mm_crc32_u64(c0, w0);
+			c1 = _mm_crc32_u64(c1, w1);
+			c2 = _mm_crc32_u64(c2, w2);
+		}
+		std::uint32_t r = ~std::uint32_t(c0);
+		r = tables::multmodp(shift, r) ^ ~std::uint32_t(c1);
+		r = tables::multmodp(shift, r) ^ ~std::uint32_t(c2);
+		c = ~r;
+		p += 3 * stream_size;
+		size -= 3 * stream_size;
+	}
+	return ~crc32c_hw_raw(c, p, size);
+}
+#endif
+
+typedef std::uint32_t (*crc32c_fn)(std::uint32_t, const void *, std::size_t);
+
+crc32c_fn select_crc32c()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_hw;
+#endif
+	return crc32c_sw;
+}
+
+}
+
+std::uint32_t crc32c(
+	std::uint32_t crc,
+	const void *data,
+	std::size_t size)
+{
+	static const crc32c_fn impl = select_crc32c();
+	return impl(crc, data, size);
+}
+
+std::uint32_t crc32c_combine(
+	std::uint32_t crc1,
+	std::uint32_t crc2,
+	std::uint64_t size2)
+{
+	return tables::multmodp(get_tables().x2nmodp(size2, 3), crc1) ^ crc2;
+}
+
+}
@@ -0,0 +1,188 @@
+#include <push/lz4.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+namespace push {
+namespace {
+
+const std::size_t min_match = 4;
+ /* the last match has to start at least 12 bytes before the end of the
+  * block, and the last 5 bytes are always literals.
+  */
+const std::size_t mf_limit = 12;
+const std::size_t last_literals = 5;
+const std::size_t max_distance = 65535;
+const unsigned hash_log = 12;
+
+inline std::uint32_t read32(const unsigned char *p)
+{
+	std::uint32_t v;
+	std::memcpy(&v, p, 4);
+	return v;
+}
+
+inline unsigned hash(std::uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - hash_log);
+}
+
+inline unsigned char *put_length(unsigned char *op, std::size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = static_cast<unsigned char>(len);
+	return op;
+}
+
+}
+
+std::size_t lz4_compress(
+	const void *src,
+	std::size_t size,
+	void *dst,
+	std::size_t capacity)
+{
+	auto const base = static_cast<const unsigned char *>(src);
+	auto const iend = base + size;
+	auto ip = base;
+	auto anchor = base;
+	auto op = static_cast<unsigned char *>(dst);
+	auto const oend = op + capacity;
+
+	if (size > mf_limit) {
+		std::uint32_t table[1 << hash_log] = { };
+		auto const ilimit = iend - mf_limit;
+		auto const matchlimit = iend - last_literals;
+		 /* position 0 is never a match candidate for itself */
+		++ip;
+		while (ip <= ilimit) {
+			unsigned h = hash(read32(ip));
+			auto ref = base + table[h];
+			table[h] = static_cast<std::uint32_t>(ip - base);
+			if (ref >= ip ||
+			    std::size_t(ip - ref) > max_distance ||
+			    read32(ref) != read32(ip)) {
+				++ip;
+				continue;
+			}
+			while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			auto m = ip + min_match;
+			auto r = ref + min_match;
+			while (m < matchlimit && *m == *r) {
+				++m;
+				++r;
+			}
+
+			std::size_t lit = ip - anchor;
+			std::size_t ml = m - ip - min_match;
+			if (std::size_t(oend - op) <
+			    1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1)
+				return 0;
+			auto token = op++;
+			*token = static_cast<unsigned char>(
+				(lit < 15 ? lit : 15) << 4 |
+				(ml < 15 ? ml : 15));
+			if (lit >= 15)
+				op = put_length(op, lit - 15);
+			std::memcpy(op, anchor, lit);
+			op += lit;
+			std::size_t off = ip - ref;
+			*op++ = static_cast<unsigned char>(off);
+			*op++ = static_cast<unsigned char>(off >> 8);
+			if (ml >= 15)
+				op = put_length(op, ml - 15);
+
+			ip = m;
+			anchor = ip;
+		}
+	}
+
+	std::size_t lit = iend - anchor;
+	if (std::size_t(oend - op) < 1 + lit / 255 + 1 + lit)
+		return 0;
+	*op++ = static_cast<unsigned char>((lit < 15 ? lit : 15) << 4);
+	if (lit >= 15)
+		op = put_length(op, lit - 15);
+	if (lit)
+		std::memcpy(op, anchor, lit);
+	op += lit;
+	return op - static_cast<unsigned char *>(dst);
+}
+
+std::size_t lz4_decompress(
+	const void *src,
+	std::size_t size,
+	void *dst,
+	std::size_t capacity)
+{
+	const std::size_t error = std::size_t(-1);
+	auto ip = static_cast<const unsigned char *>(src);
+	auto const iend = ip + size;
+	auto const base = static_cast<unsigned char *>(dst);
+	auto op = base;
+	auto const oend = op + capacity;
+
+	if (size == 0)
+		return error;
+	for (;;) {
+		if (ip == iend)
+			return error;
+		unsigned token = *ip++;
+
+		std::size_t lit = token >> 4;
+		if (lit == 15) {
+			unsigned char b;
+			do {
+				if (ip == iend)
+					return error;
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+		if (lit > std::size_t(iend - ip) || lit > std::size_t(oend - op))
+			return error;
+		std::memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return error;
+		std::size_t off = ip[0] | std::size_t(ip[1]) << 8;
+		ip += 2;
+		if (off == 0 || off > std::size_t(op - base))
+			return error;
+
+		std::size_t ml = token & 15;
+		if (ml == 15) {
+			unsigned char b;
+			do {
+				if (ip == iend)
+					return error;
+				b = *ip++;
+				ml += b;
+			} while (b == 255);
+		}
+		ml += min_match;
+		if (ml > std::size_t(oend - op))
+			return error;
+		auto ref = op - off;
+		if (off >= ml) {
+			std::memcpy(op, ref, ml);
+			op += ml;
+		} else {
+			while (ml--)
+				*op++ = *ref++;
+		}
+	}
+	return op - base;
+}
+
+}